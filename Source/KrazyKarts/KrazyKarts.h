@@ -3,5 +3,9 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Stats/Stats.h"
 
-DECLARE_LOG_CATEGORY_EXTERN(LogKrazyKarts, Log, All);
\ No newline at end of file
+DECLARE_LOG_CATEGORY_EXTERN(LogKrazyKarts, Log, All);
+
+// Use "stat KrazyKarts" to display the game counters
+DECLARE_STATS_GROUP(TEXT("KrazyKarts"), STATGROUP_KrazyKarts, STATCAT_Advanced);
\ No newline at end of file
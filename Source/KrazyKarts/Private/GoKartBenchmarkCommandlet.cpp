@@ -0,0 +1,349 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartBenchmarkCommandlet.h"
+
+#include "Dom/JsonObject.h"
+#include "Engine/World.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartMovementReplicationComponent.h"
+#include "GoKartProxyInterpolationSubsystem.h"
+#include "GoKartTelemetrySubsystem.h"
+#include "KrazyKarts/KrazyKarts.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/BitWriter.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+namespace
+{
+	// Keep the compiler from optimizing away the measured work
+	volatile double BenchmarkSink = 0.0;
+
+	TArray<FGoKartMove> MakeMoves(const int32 NumMoves, const float FirstTime)
+	{
+		TArray<FGoKartMove> Moves;
+		for (int32 Index = 0; Index < NumMoves; ++Index)
+		{
+			FGoKartMove Move;
+			Move.DeltaTime = 1.0f / 60.0f;
+			Move.Time = FirstTime + Index * Move.DeltaTime;
+			Move.Throttle = 1.0f;
+			Move.SteeringThrow = FMath::Sin(Index * 0.1f);
+			Moves.Add(Move);
+		}
+		return Moves;
+	}
+
+	template <typename T>
+	int32 GetSerializedBytes(T& Value)
+	{
+		FBitWriter Writer{0, true};
+		T::StaticStruct()->SerializeBin(Writer, &Value);
+		return static_cast<int32>(Writer.GetNumBytes());
+	}
+}
+
+UGoKartBenchmarkCommandlet::UGoKartBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UGoKartBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString OutputFileName = FPaths::ProjectSavedDir() / TEXT("Benchmarks") / TEXT("GoKartBenchmark.json");
+	FString BaselineFileName;
+	float Tolerance = 0.15f;
+	FParse::Value(*Params, TEXT("Output="), OutputFileName);
+	FParse::Value(*Params, TEXT("Baseline="), BaselineFileName);
+	FParse::Value(*Params, TEXT("Tolerance="), Tolerance);
+	FParse::Value(*Params, TEXT("Iterations="), Iterations);
+	FParse::Value(*Params, TEXT("Repetitions="), Repetitions);
+	Iterations = FMath::Max(Iterations, 1);
+	Repetitions = FMath::Max(Repetitions, 1);
+
+	Results = MakeShared<FJsonObject>();
+
+	// A kart made of the same components as AGoKartPawn, which is abstract
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false);
+	AActor* Kart = World->SpawnActor<AActor>();
+	USceneComponent* Root = NewObject<USceneComponent>(Kart, TEXT("Root"));
+	Kart->SetRootComponent(Root);
+	Root->RegisterComponent();
+	USceneComponent* MeshOffsetRoot = NewObject<USceneComponent>(Kart, TEXT("MeshOffsetRoot"));
+	MeshOffsetRoot->SetupAttachment(Root);
+	MeshOffsetRoot->RegisterComponent();
+	MovementComponent = NewObject<UGoKartMovementComponent>(Kart, TEXT("Movement"));
+	MovementComponent->RegisterComponent();
+	ReplicationComponent = NewObject<UGoKartMovementReplicationComponent>(Kart, TEXT("Replication"));
+	ReplicationComponent->RegisterComponent();
+
+	// BeginPlay is never called in this world, so do its work here
+	ReplicationComponent->MovementComponent = MovementComponent;
+	ReplicationComponent->SetMeshOffsetRoot(MeshOffsetRoot);
+	ReplicationComponent->AdaptiveNetSendRate = ReplicationComponent->ClientNetSendRate;
+
+	// ===================================================
+	// MOVEMENT
+
+	const TArray<FGoKartMove> Moves = MakeMoves(Iterations, 0.0f);
+	int32 MoveIndex = 0;
+	AddResult(TEXT("SimulateMoveTick"), MeasureNanoseconds([&]()
+	{
+		MovementComponent->SimulateMoveTick(Moves[MoveIndex++ % Moves.Num()]);
+	}), TEXT("ns"));
+
+	// ===================================================
+	// RECONCILIATION
+
+	for (const int32 NumUnacknowledgedMoves : {10, 50, 200})
+	{
+		const TArray<FGoKartMove> UnacknowledgedMoves = MakeMoves(NumUnacknowledgedMoves, 1.0f);
+		ReplicationComponent->ServerState.LastMove.Time = 0.0f; // Acknowledges none of them, all are replayed
+		ReplicationComponent->UnacknowledgedMoves = UnacknowledgedMoves;
+		AddResult(FString::Printf(TEXT("ReplayUnacknowledgedMoves_%i"), NumUnacknowledgedMoves), MeasureNanoseconds([&]()
+		{
+			ReplicationComponent->OnReplicatedServerStateForAutonomousProxy();
+		}), TEXT("ns"));
+	}
+
+	// Copying the moves back is measured separately and removed so only the clear is reported
+	const TArray<FGoKartMove> MovesToClear = MakeMoves(200, 0.0f);
+	const FGoKartMove LastServerMove = MovesToClear[99]; // Half of the moves are acknowledged
+	const double RefillNanoseconds = MeasureNanoseconds([&]()
+	{
+		ReplicationComponent->UnacknowledgedMoves = MovesToClear;
+	});
+	const double RefillAndClearNanoseconds = MeasureNanoseconds([&]()
+	{
+		ReplicationComponent->UnacknowledgedMoves = MovesToClear;
+		ReplicationComponent->ClearUnacknowledgedMoves(LastServerMove);
+	});
+	AddResult(TEXT("ClearUnacknowledgedMoves_200"), FMath::Max(RefillAndClearNanoseconds - RefillNanoseconds, 0.0), TEXT("ns"));
+	ReplicationComponent->UnacknowledgedMoves.Reset();
+
+	// ===================================================
+	// INTERPOLATION
+
+	// The per component path is measured, the batched one is measured on its own below
+	IConsoleVariable* BatchedProxyInterpolation = IConsoleManager::Get().FindConsoleVariable(TEXT("KrazyKarts.BatchedProxyInterpolation"));
+	const bool bWasBatched = BatchedProxyInterpolation && BatchedProxyInterpolation->GetBool();
+	if (BatchedProxyInterpolation) BatchedProxyInterpolation->Set(false);
+
+	ReplicationComponent->ServerState.Transform = FTransform{FQuat{FVector::UpVector, 0.3}, FVector{500.0, 200.0, 0.0}};
+	ReplicationComponent->ServerState.Velocity = FVector{10.0, 2.0, 0.0};
+	ReplicationComponent->StartTransformForSimulatedProxy = FTransform::Identity;
+	ReplicationComponent->StartVelocityForSimulatedProxy = FVector{8.0, 0.0, 0.0};
+	ReplicationComponent->ClientTimeBetweenLastReplication = 0.1f;
+	ReplicationComponent->ClientReplicationInterval = 0.1f;
+
+	for (const bool bCubic : {true, false})
+	{
+		ReplicationComponent->bSimulatedProxyUsesCubicInterpolation = bCubic;
+		AddResult(bCubic ? TEXT("SimulatedProxyTick_Cubic") : TEXT("SimulatedProxyTick_Linear"), MeasureNanoseconds([&]()
+		{
+			ReplicationComponent->ClientTimeSinceLastReplication = 0.0f;
+			ReplicationComponent->SimulatedProxyTick(0.05f);
+		}), TEXT("ns"));
+	}
+
+	if (BatchedProxyInterpolation) BatchedProxyInterpolation->Set(bWasBatched);
+
+	// Batched path for 64 proxies, per proxy, same fixture as KrazyKarts.BenchmarkProxyInterpolation
+	constexpr int32 NumProxies = 64;
+	const TArray<FGoKartProxyInterpolation> Proxies = FGoKartProxyInterpolation::MakeRandom(NumProxies);
+
+	// Kernels only, without the gather and the scatter
+	FGoKartProxyInterpolationBatch Batch;
+	for (const FGoKartProxyInterpolation& Proxy : Proxies)
+	{
+		Batch.Add(Proxy);
+	}
+	AddResult(TEXT("BatchedProxyInterpolationKernels_PerProxy"), MeasureNanoseconds([&]()
+	{
+		Batch.Evaluate();
+		BenchmarkSink = BenchmarkSink + Batch.GetLocation(0).X;
+	}) / NumProxies, TEXT("ns"));
+
+	// Full pass comparable to SimulatedProxyTick_Cubic, queued by AddProxy then evaluated and scattered to the components
+	UGoKartProxyInterpolationSubsystem* Interpolation = World->GetSubsystem<UGoKartProxyInterpolationSubsystem>();
+	TArray<USceneComponent*> ProxyMeshOffsetRoots;
+	for (int32 Index = 0; Index < NumProxies; ++Index)
+	{
+		USceneComponent* ProxyMeshOffsetRoot = NewObject<USceneComponent>(Kart);
+		ProxyMeshOffsetRoot->SetupAttachment(Root);
+		ProxyMeshOffsetRoot->RegisterComponent();
+		ProxyMeshOffsetRoots.Add(ProxyMeshOffsetRoot);
+	}
+	AddResult(TEXT("BatchedProxyInterpolationFullPass_PerProxy"), MeasureNanoseconds([&]()
+	{
+		for (int32 Index = 0; Index < NumProxies; ++Index)
+		{
+			Interpolation->AddProxy(ProxyMeshOffsetRoots[Index], MovementComponent, Proxies[Index], 10.0f);
+		}
+		Interpolation->Flush();
+	}) / NumProxies, TEXT("ns"));
+
+	// ===================================================
+	// TELEMETRY
+
+	// A record of 64 moving karts encoded and flushed to a file like on a race server, the budget is per record
+	UGoKartTelemetrySubsystem* Telemetry = World->GetSubsystem<UGoKartTelemetrySubsystem>();
+	if (Telemetry == nullptr || !Telemetry->OpenStream(FPaths::GetPath(OutputFileName) / TEXT("GoKartBenchmark.kktl"), 20.0f))
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to open the telemetry stream"), ANSI_TO_TCHAR(__FUNCTION__));
+		World->DestroyWorld(false);
+		return 1;
+	}
+
+	constexpr uint32 NumKarts = 64;
+	TArray<TPair<uint32, FGoKartState>> KartStates;
+	for (uint32 KartId = 0; KartId < NumKarts; ++KartId)
+	{
+		FGoKartState& KartState = KartStates.Emplace_GetRef(KartId, ReplicationComponent->ServerState).Value;
+		KartState.Velocity = FVector{10.0 + KartId, 2.0 * KartId, 0.0};
+	}
+	int32 NumTelemetryRecords = 0;
+	const double TelemetryRecordNanoseconds = MeasureNanoseconds([&]()
+	{
+		// Every kart moves between records so the deltas are not all zero
+		for (TPair<uint32, FGoKartState>& KartState : KartStates)
+		{
+			KartState.Value.Transform.AddToTranslation(KartState.Value.Velocity * 5.0);
+		}
+		Telemetry->WriteRecord(NumTelemetryRecords * 0.05, NumTelemetryRecords % 100 == 0, KartStates);
+		++NumTelemetryRecords;
+	});
+	AddResult(FString::Printf(TEXT("TelemetryRecord_%iKarts"), NumKarts), TelemetryRecordNanoseconds, TEXT("ns"));
+
+	if (const IConsoleVariable* TelemetryBudgetMs = IConsoleManager::Get().FindConsoleVariable(TEXT("KrazyKarts.Telemetry.BudgetMs")))
+	{
+		UE_LOG(LogKrazyKarts, Display, TEXT("Telemetry record of %i karts costs %.4f ms, budget %.4f ms"),
+			NumKarts, TelemetryRecordNanoseconds / 1e6, TelemetryBudgetMs->GetFloat());
+	}
+
+	// ===================================================
+	// SERIALIZATION
+
+	FGoKartMove Move = Moves[0];
+	FGoKartState State = ReplicationComponent->ServerState;
+	AddResult(TEXT("SerializedSize_GoKartMove"), GetSerializedBytes(Move), TEXT("bytes"));
+	AddResult(TEXT("SerializedSize_GoKartState"), GetSerializedBytes(State), TEXT("bytes"));
+
+	World->DestroyWorld(false);
+
+	// ===================================================
+	// REPORT
+
+	FString Json;
+	const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+	FJsonSerializer::Serialize(Results.ToSharedRef(), Writer);
+	if (!FFileHelper::SaveStringToFile(Json, *OutputFileName))
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to write %s"), ANSI_TO_TCHAR(__FUNCTION__), *OutputFileName);
+		return 1;
+	}
+	UE_LOG(LogKrazyKarts, Display, TEXT("Benchmark results written to %s"), *OutputFileName);
+
+	if (BaselineFileName.IsEmpty())
+	{
+		return 0;
+	}
+
+	if (!CompareWithBaseline(BaselineFileName, Tolerance))
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("Benchmark failed compared to %s"), *BaselineFileName);
+		return 1;
+	}
+
+	UE_LOG(LogKrazyKarts, Display, TEXT("Benchmark passed, no regression compared to %s"), *BaselineFileName);
+	return 0;
+}
+
+double UGoKartBenchmarkCommandlet::MeasureNanoseconds(const TFunctionRef<void()> Function) const
+{
+	// Warm up caches before measuring
+	for (int32 Iteration = 0; Iteration < FMath::Min(Iterations, 100); ++Iteration)
+	{
+		Function();
+	}
+
+	// The best repetition is the least disturbed by the rest of the machine
+	double BestSeconds = TNumericLimits<double>::Max();
+	for (int32 Repetition = 0; Repetition < Repetitions; ++Repetition)
+	{
+		const double StartSeconds = FPlatformTime::Seconds();
+		for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+		{
+			Function();
+		}
+		BestSeconds = FMath::Min(BestSeconds, FPlatformTime::Seconds() - StartSeconds);
+	}
+
+	return BestSeconds * 1e9 / Iterations;
+}
+
+void UGoKartBenchmarkCommandlet::AddResult(const FString& Name, const double Value, const FString& Unit)
+{
+	const TSharedRef<FJsonObject> Result = MakeShared<FJsonObject>();
+	Result->SetNumberField(TEXT("Value"), Value);
+	Result->SetStringField(TEXT("Unit"), Unit);
+	Results->SetObjectField(Name, Result);
+
+	UE_LOG(LogKrazyKarts, Display, TEXT("%-40s %12.2f %s"), *Name, Value, *Unit);
+}
+
+bool UGoKartBenchmarkCommandlet::CompareWithBaseline(const FString& BaselineFileName, const float Tolerance) const
+{
+	FString Json;
+	TSharedPtr<FJsonObject> Baseline;
+	if (!FFileHelper::LoadFileToString(Json, *BaselineFileName)
+		|| !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Json), Baseline) || !Baseline.IsValid())
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to read baseline %s"), ANSI_TO_TCHAR(__FUNCTION__), *BaselineFileName);
+		return false;
+	}
+
+	// Every result is a cost, lower is better
+	int32 NumRegressions = 0;
+	for (const TPair<FString, TSharedPtr<FJsonValue>>& Result : Results->Values)
+	{
+		const TSharedPtr<FJsonObject>* BaselineResult;
+		if (!Baseline->TryGetObjectField(Result.Key, BaselineResult))
+		{
+			UE_LOG(LogKrazyKarts, Warning, TEXT("%-40s not in baseline"), *Result.Key);
+			continue;
+		}
+
+		const double Value = Result.Value->AsObject()->GetNumberField(TEXT("Value"));
+		const double BaselineValue = (*BaselineResult)->GetNumberField(TEXT("Value"));
+		const double Change = BaselineValue > 0.0 ? Value / BaselineValue - 1.0 : 0.0;
+		const bool bRegression = Change > Tolerance;
+		NumRegressions += bRegression ? 1 : 0;
+
+		UE_LOG(LogKrazyKarts, Display, TEXT("%-40s %12.2f vs %12.2f (%+.1f%%)%s"),
+			*Result.Key, Value, BaselineValue, Change * 100.0, bRegression ? TEXT(" REGRESSION") : TEXT(""));
+	}
+
+	// A measure that disappeared can not be compared, the baseline must be updated on purpose
+	int32 NumMissingResults = 0;
+	for (const TPair<FString, TSharedPtr<FJsonValue>>& BaselineResult : Baseline->Values)
+	{
+		if (!Results->HasField(BaselineResult.Key))
+		{
+			UE_LOG(LogKrazyKarts, Error, TEXT("%-40s in baseline but not measured"), *BaselineResult.Key);
+			++NumMissingResults;
+		}
+	}
+
+	if (NumRegressions > 0 || NumMissingResults > 0)
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] %i regression(s), %i missing result(s)"), ANSI_TO_TCHAR(__FUNCTION__), NumRegressions, NumMissingResults);
+		return false;
+	}
+
+	return true;
+}
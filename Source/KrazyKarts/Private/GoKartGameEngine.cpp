@@ -0,0 +1,19 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartGameEngine.h"
+
+#include "GoKartRaceHostSubsystem.h"
+#include "Engine/NetConnection.h"
+
+bool UGoKartGameEngine::NetworkRemapPath(UNetConnection* Connection, FString& Str, const bool bReading)
+{
+	bool bRemapped = Super::NetworkRemapPath(Connection, Str, bReading);
+
+	if (const UGoKartRaceHostSubsystem* RaceHost = UGoKartRaceHostSubsystem::Get(); RaceHost && Connection)
+	{
+		bRemapped |= RaceHost->RemapRaceSessionPath(Connection->GetWorld(), Str, bReading);
+	}
+
+	return bRemapped;
+}
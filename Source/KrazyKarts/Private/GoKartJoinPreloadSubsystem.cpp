@@ -0,0 +1,95 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartJoinPreloadSubsystem.h"
+
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
+#include "KrazyKarts/KrazyKarts.h"
+
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Join To Drivable (ms)"), STAT_KrazyKartsJoinToDrivable, STATGROUP_KrazyKarts);
+
+bool UGoKartJoinPreloadSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	// Nobody drives on a dedicated server
+	return !IsRunningDedicatedServer() && Super::ShouldCreateSubsystem(Outer);
+}
+
+void UGoKartJoinPreloadSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	// Called when the client starts loading the map of the server it joins, long before the kart is spawned
+	FCoreUObjectDelegates::PreLoadMap.AddUObject(this, &ThisClass::OnPreLoadMap);
+}
+
+void UGoKartJoinPreloadSubsystem::Deinitialize()
+{
+	FCoreUObjectDelegates::PreLoadMap.RemoveAll(this);
+	PreloadHandle.Reset();
+
+	Super::Deinitialize();
+}
+
+void UGoKartJoinPreloadSubsystem::NotifyDrivable()
+{
+	if (bDrivableReported)
+	{
+		return;
+	}
+	bDrivableReported = true;
+
+	const double JoinToDrivableMilliseconds = (FPlatformTime::Seconds() - JoinStartSeconds) * 1000.0;
+	SET_FLOAT_STAT(STAT_KrazyKartsJoinToDrivable, JoinToDrivableMilliseconds);
+	UE_LOG(LogKrazyKarts, Log, TEXT("[%s] Join to drivable took %.1f ms"), ANSI_TO_TCHAR(__FUNCTION__), JoinToDrivableMilliseconds);
+}
+
+void UGoKartJoinPreloadSubsystem::OnPreLoadMap(const FString& MapName)
+{
+	// Every join or travel starts a new measure
+	JoinStartSeconds = FPlatformTime::Seconds();
+	bDrivableReported = false;
+
+	StartPreload();
+}
+
+void UGoKartJoinPreloadSubsystem::StartPreload()
+{
+	if (JoinStartSeconds == 0.0)
+	{
+		JoinStartSeconds = FPlatformTime::Seconds();
+	}
+
+	// Assets stay loaded by the handle from a previous join
+	if (PreloadHandle.IsValid() || bJoinAssetsLoaded)
+	{
+		return;
+	}
+
+	TArray<FSoftObjectPath> AssetsToLoad;
+	if (!KartPawnClass.IsNull()) AssetsToLoad.Add(KartPawnClass.ToSoftObjectPath());
+	for (const TSoftObjectPtr<UObject>& Asset : PreloadAssets)
+	{
+		if (!Asset.IsNull()) AssetsToLoad.Add(Asset.ToSoftObjectPath());
+	}
+
+	if (AssetsToLoad.IsEmpty())
+	{
+		OnPreloadCompleted();
+		return;
+	}
+
+	// Streamed in the background, the map load flushes async loading so they are ready once the map is
+	PreloadHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(
+		AssetsToLoad, FStreamableDelegate::CreateUObject(this, &ThisClass::OnPreloadCompleted),
+		FStreamableManager::AsyncLoadHighPriority);
+}
+
+void UGoKartJoinPreloadSubsystem::OnPreloadCompleted()
+{
+	bJoinAssetsLoaded = true;
+	UE_LOG(LogKrazyKarts, Log, TEXT("[%s] Join assets loaded in %.1f ms"),
+		ANSI_TO_TCHAR(__FUNCTION__), (FPlatformTime::Seconds() - JoinStartSeconds) * 1000.0);
+
+	OnJoinAssetsLoaded.Broadcast();
+}
@@ -40,7 +40,12 @@ void UGoKartMovementComponent::TickComponent(float DeltaTime, ELevelTick TickTyp
 	if (Pawn->IsLocallyControlled())
 	{
 		LastMove = CreateMoveData(DeltaTime);
-		SimulateMoveTick(LastMove);
+
+		// The autonomous proxy predicts the merged moves it sends, see UGoKartMovementReplicationComponent::CoalesceAndSendMove
+		if (Pawn->GetLocalRole() != ROLE_AutonomousProxy)
+		{
+			SimulateMove(LastMove);
+		}
 	}
 }
 
@@ -62,6 +67,19 @@ void UGoKartMovementComponent::SimulateMoveTick(const FGoKartMove& Move)
 	UpdateLocation(Move);
 }
 
+void UGoKartMovementComponent::SimulateMove(const FGoKartMove& Move)
+{
+	// Equal sub-steps only depend on the move, so the prediction, the server and the replay always take the same steps
+	const int32 NumSteps = FMath::Clamp(FMath::CeilToInt32(Move.DeltaTime / MaxSimulationStep), 1, MaxSimulationSteps);
+
+	FGoKartMove Step = Move;
+	Step.DeltaTime = Move.DeltaTime / NumSteps;
+	for (int32 Index = 0; Index < NumSteps; ++Index)
+	{
+		SimulateMoveTick(Step);
+	}
+}
+
 FGoKartMove UGoKartMovementComponent::CreateMoveData(const float DeltaTime) const
 {
 	// World TimeSeconds vs. ServerWorld TimeSeconds
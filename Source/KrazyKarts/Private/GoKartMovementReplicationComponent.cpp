@@ -3,10 +3,50 @@
 
 #include "GoKartMovementReplicationComponent.h"
 
+#include "EngineUtils.h"
 #include "GoKartPawn.h"
+#include "GoKartProxyInterpolationSubsystem.h"
 #include "KrazyKarts/KrazyKarts.h"
+#include "Engine/NetConnection.h"
+#include "GameFramework/PlayerState.h"
 #include "Net/UnrealNetwork.h"
 
+static TAutoConsoleVariable<bool> CVarBatchedProxyInterpolation(
+	TEXT("KrazyKarts.BatchedProxyInterpolation"), true,
+	TEXT("If true the cubic interpolation of all simulated proxies is evaluated in a single batch, see UGoKartProxyInterpolationSubsystem"));
+
+static TAutoConsoleVariable<float> CVarServerMoveQueueLogInterval(
+	TEXT("KrazyKarts.ServerMoveQueueLogInterval"), 0.0f,
+	TEXT("Seconds between two logs of the move queue of each client on the server, 0 disables it"));
+
+static void ListServerMoveQueues(UWorld* World)
+{
+	for (const AGoKartPawn* Kart : TActorRange<AGoKartPawn>(World))
+	{
+		const UGoKartMovementReplicationComponent* Replication = Kart->FindComponentByClass<UGoKartMovementReplicationComponent>();
+		if (Replication != nullptr && Kart->HasAuthority() && !Kart->IsLocallyControlled())
+		{
+			Replication->LogServerMoveQueue();
+		}
+	}
+}
+
+static FAutoConsoleCommandWithWorld ListServerMoveQueuesCommand(
+	TEXT("KrazyKarts.ListServerMoveQueues"),
+	TEXT("Log the queue depth and the throttled moves of each client connection, run it on the server"),
+	FConsoleCommandWithWorldDelegate::CreateStatic(&ListServerMoveQueues));
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Predicted Frames"), STAT_KrazyKartsPredictedFrames, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sent Moves"), STAT_KrazyKartsSentMoves, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queued Server Moves"), STAT_KrazyKartsQueuedServerMoves, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Throttled Server Moves"), STAT_KrazyKartsThrottledServerMoves, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Round Trip Time (ms)"), STAT_KrazyKartsRoundTripTime, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Round Trip Jitter (ms)"), STAT_KrazyKartsRoundTripJitter, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Packet Loss (%)"), STAT_KrazyKartsPacketLoss, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Adaptive Net Send Rate"), STAT_KrazyKartsAdaptiveNetSendRate, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Interpolation Delay (ms)"), STAT_KrazyKartsInterpolationDelay, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Process Server Moves"), STAT_KrazyKartsProcessServerMoves, STATGROUP_KrazyKarts);
+
 // Sets default values for this component's properties
 UGoKartMovementReplicationComponent::UGoKartMovementReplicationComponent()
 {
@@ -30,6 +70,24 @@ void UGoKartMovementReplicationComponent::BeginPlay()
 
 	MovementComponent = GetOwner()->FindComponentByClass<UGoKartMovementComponent>();
 	check(MovementComponent);
+
+	// The move of the frame is created by the movement component, it must be ready when this component ticks
+	AddTickPrerequisiteComponent(MovementComponent);
+
+	ServerMoveTokens = ServerMoveBurst;
+	AdaptiveNetSendRate = ClientNetSendRate;
+}
+
+// Called when the game ends or the component is destroyed
+void UGoKartMovementReplicationComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (NumSentMoves > 0)
+	{
+		UE_LOG(LogKrazyKarts, Log, TEXT("[%s] Coalesced %i predicted frames into %i sent moves (%.2f frames per move)"),
+			ANSI_TO_TCHAR(__FUNCTION__), NumPredictedFrames, NumSentMoves, static_cast<float>(NumPredictedFrames) / NumSentMoves);
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 // Called every frame
@@ -59,12 +117,8 @@ void UGoKartMovementReplicationComponent::TickComponent(float DeltaTime, ELevelT
 		
 		if (Pawn->GetLocalRole() == ROLE_AutonomousProxy)
 		{
-			// Add client move's to the buffer of unacknowledged player moves
-			UnacknowledgedMoves.Add(LastMove);
-			// UE_LOG(LogKrazyKarts, Log, TEXT("UnacknowledgedMoves.Num() == %i"), UnacknowledgedMoves.Num());
-
-			// Called from client and executed on the server (client request goes over network, has latency)
-			ServerSendMove(LastMove);
+			// Prediction runs every frame but frames with similar input are predicted and sent as a single move
+			CoalesceAndSendMove(LastMove);
 		}
 		else
 		{
@@ -84,6 +138,11 @@ void UGoKartMovementReplicationComponent::TickComponent(float DeltaTime, ELevelT
 		// Use the replicated server state to simulate some other client locally on this client
 		// MovementComponent->SimulateMoveTick(ServerState.LastMove);
 	}
+	else if (Pawn->GetLocalRole() == ROLE_Authority)
+	{
+		// Simulate the moves received from the owning client since last frame
+		ProcessServerMoveQueue(DeltaTime);
+	}
 }
 
 void UGoKartMovementReplicationComponent::ClearUnacknowledgedMoves(const FGoKartMove& LastServerMove)
@@ -100,6 +159,174 @@ void UGoKartMovementReplicationComponent::ClearUnacknowledgedMoves(const FGoKart
 	UnacknowledgedMoves = NewMoves;
 }
 
+void UGoKartMovementReplicationComponent::UpdateConnectionQuality(const FGoKartMove& LastServerMove)
+{
+	// The newest move covered by this acknowledgment gives the round trip time sample
+	double AcknowledgedSendSeconds = -1.0;
+	int32 NumAcknowledgedMoves = 0;
+	for (const TPair<float, double>& MoveSendTime : MoveSendTimes)
+	{
+		if (MoveSendTime.Key > LastServerMove.Time)
+		{
+			break;
+		}
+		AcknowledgedSendSeconds = MoveSendTime.Value;
+		++NumAcknowledgedMoves;
+	}
+
+	// Same acknowledgment replicated again (e.g. server state changed for another reason)
+	if (NumAcknowledgedMoves == 0)
+	{
+		return;
+	}
+	MoveSendTimes.RemoveAt(0, NumAcknowledgedMoves, false);
+
+	// Smoothed like TCP does https://www.rfc-editor.org/rfc/rfc6298, except the jitter starts at 0 because
+	// half the round trip time would already be a bad jitter on most connections
+	const float RoundTripTimeSample = FPlatformTime::Seconds() - AcknowledgedSendSeconds;
+	if (RoundTripTime <= 0.0f)
+	{
+		RoundTripTime = RoundTripTimeSample;
+		RoundTripTimeJitter = 0.0f;
+	}
+	else
+	{
+		RoundTripTimeJitter = FMath::Lerp(RoundTripTimeJitter, FMath::Abs(RoundTripTime - RoundTripTimeSample), 0.25f);
+		RoundTripTime = FMath::Lerp(RoundTripTime, RoundTripTimeSample, 0.125f);
+	}
+
+	// Moves go from client to server, so the outgoing loss is the one that matters
+	if (const UNetConnection* Connection = GetOwner()->GetNetConnection())
+	{
+		PacketLoss = Connection->GetOutLossPercentage().GetAvgLossPercentage() * 100.0f;
+	}
+
+	// 0 on a good connection, 1 when any of the measures reaches its bad threshold,
+	// the full send rate is kept until enough samples were measured for them to be meaningful
+	const float ConnectionBadness = ++NumRoundTripTimeSamples < MinConnectionQualitySamples ? 0.0f : FMath::Clamp(FMath::Max3(
+		RoundTripTime / BadConnectionRoundTripTime,
+		RoundTripTimeJitter / BadConnectionJitter,
+		PacketLoss / BadConnectionPacketLoss), 0.0f, 1.0f);
+
+	// Fewer longer moves on a bad connection, each packet costs bandwidth and is resent when lost
+	AdaptiveNetSendRate = FMath::Lerp(ClientNetSendRate, FMath::Min(MinClientNetSendRate, ClientNetSendRate), ConnectionBadness);
+
+	SET_FLOAT_STAT(STAT_KrazyKartsRoundTripTime, RoundTripTime * 1000.0f);
+	SET_FLOAT_STAT(STAT_KrazyKartsRoundTripJitter, RoundTripTimeJitter * 1000.0f);
+	SET_FLOAT_STAT(STAT_KrazyKartsPacketLoss, PacketLoss);
+	SET_FLOAT_STAT(STAT_KrazyKartsAdaptiveNetSendRate, AdaptiveNetSendRate);
+}
+
+void UGoKartMovementReplicationComponent::CoalesceAndSendMove(const FGoKartMove& FrameMove)
+{
+	++NumPredictedFrames;
+	INC_DWORD_STAT(STAT_KrazyKartsPredictedFrames);
+
+	// Input changed, so send what we have and start a new move with this frame. Not before a full interval at
+	// ClientNetSendRate, otherwise an analog stick would send a move every frame, the frame is merged instead
+	// and the input averaged into a single move is bounded by that interval
+	if (PendingMove.DeltaTime >= 1.0f / ClientNetSendRate && !PendingMove.CanCoalesceWith(FrameMove, MoveCoalescingInputTolerance))
+	{
+		SendMove(PendingMove);
+		PendingMove = FGoKartMove{};
+	}
+
+	// Like CharacterMovement combining moves, go back to the state at the start of the pending move and simulate
+	// the merged move, so the prediction takes the same steps with the same input as the server and the replay
+	if (PendingMove.DeltaTime > 0.0f)
+	{
+		GetOwner()->SetActorTransform(PendingMoveStartTransform);
+		MovementComponent->SetVelocity(PendingMoveStartVelocity);
+		PendingMove.Coalesce(FrameMove);
+	}
+	else
+	{
+		PendingMoveStartTransform = GetOwner()->GetActorTransform();
+		PendingMoveStartVelocity = MovementComponent->GetVelocity();
+		PendingMove = FrameMove;
+	}
+	MovementComponent->SimulateMove(PendingMove);
+
+	// Send once the pending move covers a full net send interval
+	if (PendingMove.DeltaTime >= 1.0f / AdaptiveNetSendRate)
+	{
+		SendMove(PendingMove);
+		PendingMove = FGoKartMove{};
+	}
+}
+
+void UGoKartMovementReplicationComponent::SendMove(const FGoKartMove& Move)
+{
+	++NumSentMoves;
+	INC_DWORD_STAT(STAT_KrazyKartsSentMoves);
+
+	// Add client move's to the buffer of unacknowledged player moves
+	UnacknowledgedMoves.Add(Move);
+	MoveSendTimes.Emplace(Move.Time, FPlatformTime::Seconds());
+
+	// Called from client and executed on the server (client request goes over network, has latency)
+	ServerSendMove(Move);
+}
+
+void UGoKartMovementReplicationComponent::ProcessServerMoveQueue(const float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KrazyKartsProcessServerMoves);
+
+	ServerMoveTokens = FMath::Min(ServerMoveTokens + DeltaTime * ServerMoveRate, ServerMoveBurst);
+	INC_DWORD_STAT_BY(STAT_KrazyKartsQueuedServerMoves, ServerMoveQueue.Num());
+
+	// The stats add up all the clients, this shows each one of them even on a dedicated server
+	TimeSinceServerMoveQueueLog += DeltaTime;
+	if (const float LogInterval = CVarServerMoveQueueLogInterval.GetValueOnGameThread();
+		LogInterval > 0.0f && TimeSinceServerMoveQueueLog >= LogInterval)
+	{
+		TimeSinceServerMoveQueueLog = 0.0f;
+		LogServerMoveQueue();
+	}
+
+	if (ServerMoveQueue.IsEmpty())
+	{
+		return;
+	}
+
+	const double StartSeconds = FPlatformTime::Seconds();
+	const double BudgetSeconds = ServerMoveBudgetMs / 1000.0;
+	int32 NumProcessedMoves = 0;
+
+	while (NumProcessedMoves < ServerMoveQueue.Num()
+		&& NumProcessedMoves < MaxServerMovesPerFrame
+		&& ServerMoveTokens >= 1.0f)
+	{
+		MovementComponent->SimulateMove(ServerMoveQueue[NumProcessedMoves]);
+		ServerMoveTokens -= 1.0f;
+		++NumProcessedMoves;
+
+		// The CPU budget is checked after the move, so at least one move runs per frame whenever the rate limit has a token
+		if (FPlatformTime::Seconds() - StartSeconds > BudgetSeconds)
+		{
+			break;
+		}
+	}
+
+	if (NumProcessedMoves > 0)
+	{
+		UpdateServerState(ServerMoveQueue[NumProcessedMoves - 1]);
+		ServerMoveQueue.RemoveAt(0, NumProcessedMoves, false);
+	}
+}
+
+void UGoKartMovementReplicationComponent::LogServerMoveQueue() const
+{
+	const APawn* Pawn = GetOwner<APawn>();
+	const APlayerState* PlayerState = Pawn ? Pawn->GetPlayerState() : nullptr;
+	const UNetConnection* Connection = GetOwner()->GetNetConnection();
+
+	UE_LOG(LogKrazyKarts, Display, TEXT("[%s] %s (%s): queued %i, throttled %i, tokens %.1f"),
+		ANSI_TO_TCHAR(__FUNCTION__), PlayerState ? *PlayerState->GetPlayerName() : *GetNameSafe(GetOwner()),
+		Connection ? *Connection->LowLevelGetRemoteAddress(true) : TEXT("no connection"),
+		ServerMoveQueue.Num(), NumThrottledServerMoves, ServerMoveTokens);
+}
+
 void UGoKartMovementReplicationComponent::UpdateServerState(const FGoKartMove& Move)
 {
 	// Update the server state
@@ -113,7 +340,7 @@ void UGoKartMovementReplicationComponent::SimulatedProxyTick(const float DeltaTi
 	ClientTimeSinceLastReplication += DeltaTime;
 	
 	// If first frame then skip
-	if (ClientTimeBetweenLastReplication < KINDA_SMALL_NUMBER)
+	if (ClientReplicationInterval < KINDA_SMALL_NUMBER)
 	{
 		return;
 	}
@@ -130,15 +357,36 @@ void UGoKartMovementReplicationComponent::SimulatedProxyTick(const float DeltaTi
 		// NOTE: This is required because we need the derivative in terms of Alpha
 		// (1) Slope = Derivative = DeltaLocation / DeltaAlpha
 		// (2) Velocity = DeltaLocation / DeltaTime
-		// (3) DeltaAlpha = DeltaTime / ClientTimeBetweenLastReplication
+		// (3) DeltaAlpha = DeltaTime / ClientReplicationInterval
 		// Put (3) in (1)
-		// (4) Derivative = DeltaLocation / (DeltaTime / ClientTimeBetweenLastReplication)
-		// (5) Derivative = Velocity * ClientTimeBetweenLastReplication
+		// (4) Derivative = DeltaLocation / (DeltaTime / ClientReplicationInterval)
+		// (5) Derivative = Velocity * ClientReplicationInterval
+		// The server moved the kart from start to target in ClientReplicationInterval, the interpolation delay only
+		// slows down the traversal, scaling the tangents with it would make the curve overshoot
 
 		// Calculate a point over the cubic function
-		const float VelocityToDerivative = ClientTimeBetweenLastReplication * 100; // Multiply by 100 to convert velocity at next line from m/s to cm/s
+		const float VelocityToDerivative = ClientReplicationInterval * 100; // Multiply by 100 to convert velocity at next line from m/s to cm/s
 		const FVector StartDerivative = StartVelocityForSimulatedProxy * VelocityToDerivative;
 		const FVector TargetDerivative = ServerState.Velocity * VelocityToDerivative; 
+
+		// Evaluated later this frame together with all the other simulated proxies
+		if (CVarBatchedProxyInterpolation.GetValueOnGameThread())
+		{
+			if (UGoKartProxyInterpolationSubsystem* Interpolation = GetWorld()->GetSubsystem<UGoKartProxyInterpolationSubsystem>())
+			{
+				FGoKartProxyInterpolation Proxy;
+				Proxy.StartLocation = StartLocation;
+				Proxy.StartDerivative = StartDerivative;
+				Proxy.TargetLocation = TargetLocation;
+				Proxy.TargetDerivative = TargetDerivative;
+				Proxy.StartRotation = StartTransformForSimulatedProxy.GetRotation();
+				Proxy.TargetRotation = ServerState.Transform.GetRotation();
+				Proxy.Alpha = LerpRatio;
+				Interpolation->AddProxy(MeshOffsetRoot, MovementComponent, Proxy, VelocityToDerivative);
+				return;
+			}
+		}
+
 		NewLocation = FMath::CubicInterp(StartLocation, StartDerivative, TargetLocation, TargetDerivative, LerpRatio);
 
 		// Calculate the first derivative of point over the cubic curve
@@ -186,14 +434,23 @@ void UGoKartMovementReplicationComponent::ServerSendMove_Implementation(const FG
 
 	ClientSimulatedTime += Move.DeltaTime;
 	
-	// NOTE: Doing here and not on Tick because otherwise the server would be simulating
-	// with the last received input and would cause the client to move back to the last "speculative"
-	// server state
+	// NOTE: Queue the received moves and simulate them on Tick (see ProcessServerMoveQueue), never
+	// simulate with the last received input for frames without moves because it would cause the client
+	// to move back to the last "speculative" server state
 	// https://bugs.mojang.com/browse/MCPE-102760
 	// https://forum.unity.com/threads/glitchy-client-side-prediction.1192453/	
-	
-	MovementComponent->SimulateMoveTick(Move);
-	UpdateServerState(Move);
+
+	// Degrade gracefully, a flooding or lagged client gets fewer longer moves instead of stalling the server.
+	// Enforced here so the queue never grows past the cap whatever the number of moves received this frame
+	if (ServerMoveQueue.Num() >= FMath::Max(MaxQueuedServerMoves, 1))
+	{
+		ServerMoveQueue.Last().Coalesce(Move);
+		++NumThrottledServerMoves;
+		INC_DWORD_STAT(STAT_KrazyKartsThrottledServerMoves);
+		return;
+	}
+
+	ServerMoveQueue.Add(Move);
 }
 
 // ===================================================
@@ -225,12 +482,21 @@ void UGoKartMovementReplicationComponent::OnReplicatedServerStateForAutonomousPr
 	MovementComponent->SetVelocity(ServerState.Velocity);
 
 	// Clear moves generated previously than last server replicated move
+	UpdateConnectionQuality(ServerState.LastMove);
 	ClearUnacknowledgedMoves(ServerState.LastMove);
 
 	// Simulate client moves that are ahead of the last server response
 	for (const FGoKartMove& Move : UnacknowledgedMoves)
 	{
-		MovementComponent->SimulateMoveTick(Move);
+		MovementComponent->SimulateMove(Move);
+	}
+
+	// Frames already predicted locally but still waiting to be sent, replayed the same way the server will simulate them
+	if (PendingMove.DeltaTime > 0.0f)
+	{
+		PendingMoveStartTransform = GetOwner()->GetActorTransform();
+		PendingMoveStartVelocity = MovementComponent->GetVelocity();
+		MovementComponent->SimulateMove(PendingMove);
 	}
 }
 
@@ -242,7 +508,23 @@ void UGoKartMovementReplicationComponent::OnReplicatedServerStateForSimulatedPro
 		return;
 	};
 	
-	ClientTimeBetweenLastReplication = ClientTimeSinceLastReplication;
+	// Absorb the jitter of server updates by interpolating a bit slower than they arrive,
+	// so the proxy is less likely to reach the target and wait (or overshoot) before the next update
+	if (const float ReplicationInterval = ClientTimeSinceLastReplication; AverageReplicationInterval <= 0.0f)
+	{
+		AverageReplicationInterval = ReplicationInterval;
+	}
+	else
+	{
+		ReplicationIntervalJitter = FMath::Lerp(ReplicationIntervalJitter, FMath::Abs(AverageReplicationInterval - ReplicationInterval), 0.25f);
+		AverageReplicationInterval = FMath::Lerp(AverageReplicationInterval, ReplicationInterval, 0.125f);
+	}
+	InterpolationDelay = FMath::Clamp(2.0f * ReplicationIntervalJitter, MinInterpolationDelay, FMath::Max(MinInterpolationDelay, MaxInterpolationDelay));
+
+	SET_FLOAT_STAT(STAT_KrazyKartsInterpolationDelay, InterpolationDelay * 1000.0f);
+
+	ClientReplicationInterval = ClientTimeSinceLastReplication;
+	ClientTimeBetweenLastReplication = ClientReplicationInterval + InterpolationDelay;
 	ClientTimeSinceLastReplication = 0;
 	StartTransformForSimulatedProxy.SetLocation(MeshOffsetRoot->GetComponentLocation());
 	StartTransformForSimulatedProxy.SetRotation(MeshOffsetRoot->GetComponentQuat());
@@ -19,6 +19,28 @@ void DebugActorRole(AGoKartPawn* Actor, float DeltaTime)
 	default: ;
 	}
 
+	// Show the network state of the kart on this machine
+	if (const UGoKartMovementReplicationComponent* Replication = Actor->FindComponentByClass<UGoKartMovementReplicationComponent>())
+	{
+		if (Actor->GetLocalRole() == ROLE_Authority && !Actor->IsLocallyControlled())
+		{
+			// How far behind the server is simulating the moves of the owning client
+			RoleNameString += FString::Printf(TEXT("\nQueued %i | Throttled %i"),
+				Replication->GetServerMoveQueueDepth(), Replication->GetNumThrottledServerMoves());
+		}
+		else if (Actor->GetLocalRole() == ROLE_AutonomousProxy)
+		{
+			// Parameters adapted to the connection quality
+			RoleNameString += FString::Printf(TEXT("\nRTT %.0f ms | Jitter %.0f ms | Loss %.1f%% | %.0f moves/s"),
+				Replication->GetRoundTripTime() * 1000.0f, Replication->GetRoundTripTimeJitter() * 1000.0f,
+				Replication->GetPacketLoss(), Replication->GetAdaptiveNetSendRate());
+		}
+		else if (Actor->GetLocalRole() == ROLE_SimulatedProxy)
+		{
+			RoleNameString += FString::Printf(TEXT("\nInterpolation delay %.0f ms"), Replication->GetInterpolationDelay() * 1000.0f);
+		}
+	}
+
 	DrawDebugString(Actor->GetWorld(), FVector::UpVector * 80, RoleNameString, Actor, FColor::White, DeltaTime);
 }
 
@@ -41,6 +63,11 @@ void AGoKartPawn::BeginPlay()
 {
 	Super::BeginPlay();
 
+	// Tick only draws debug info, no one can see it on a dedicated server
+	if (IsNetMode(NM_DedicatedServer))
+	{
+		SetActorTickEnabled(false);
+	}
 }
 
 // Called every frame
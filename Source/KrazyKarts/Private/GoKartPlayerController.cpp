@@ -4,20 +4,94 @@
 #include "GoKartPlayerController.h"
 
 #include "EnhancedInputSubsystems.h"
+#include "GoKartJoinPreloadSubsystem.h"
 #include "InputMappingContext.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
+#include "KrazyKarts/KrazyKarts.h"
 
 void AGoKartPlayerController::BeginPlay()
 {
 	Super::BeginPlay();
-	
-	if (const ULocalPlayer* LocalPlayer = Cast<ULocalPlayer>(Player))
+
+	// Only the owning client binds input, the server copy of the controller has nothing to load
+	if (!IsLocalController())
 	{
-		if (UEnhancedInputLocalPlayerSubsystem* InputSystem = LocalPlayer->GetSubsystem<UEnhancedInputLocalPlayerSubsystem>())
+		return;
+	}
+
+	// The kart assets are streamed since the join started, wait for them if they are not ready yet
+	if (UGoKartJoinPreloadSubsystem* Preload = GetGameInstance()->GetSubsystem<UGoKartJoinPreloadSubsystem>())
+	{
+		Preload->StartPreload();
+		if (!Preload->AreJoinAssetsLoaded())
 		{
-			if (!InputMapping.IsNull())
-			{
-				InputSystem->AddMappingContext(InputMapping.LoadSynchronous(), 0);
-			}
+			JoinAssetsLoadedHandle = Preload->OnJoinAssetsLoaded.AddUObject(this, &ThisClass::TryBecomeDrivable);
 		}
 	}
+
+	if (InputMapping.IsNull())
+	{
+		OnInputMappingLoaded();
+		return;
+	}
+
+	// Instantly completed when the join preload already loaded it, never blocks the game thread otherwise
+	InputMappingHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(
+		InputMapping.ToSoftObjectPath(), FStreamableDelegate::CreateUObject(this, &ThisClass::OnInputMappingLoaded),
+		FStreamableManager::AsyncLoadHighPriority);
+}
+
+void AGoKartPlayerController::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UGoKartJoinPreloadSubsystem* Preload = GetGameInstance() ? GetGameInstance()->GetSubsystem<UGoKartJoinPreloadSubsystem>() : nullptr)
+	{
+		Preload->OnJoinAssetsLoaded.Remove(JoinAssetsLoadedHandle);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AGoKartPlayerController::AcknowledgePossession(APawn* P)
+{
+	Super::AcknowledgePossession(P);
+
+	TryBecomeDrivable();
+}
+
+void AGoKartPlayerController::OnInputMappingLoaded()
+{
+	bInputMappingLoaded = true;
+
+	TryBecomeDrivable();
+}
+
+void AGoKartPlayerController::TryBecomeDrivable()
+{
+	UGoKartJoinPreloadSubsystem* Preload = GetGameInstance()->GetSubsystem<UGoKartJoinPreloadSubsystem>();
+	if (bDrivable || !bInputMappingLoaded || GetPawn() == nullptr || (Preload && !Preload->AreJoinAssetsLoaded()))
+	{
+		return;
+	}
+
+	const ULocalPlayer* LocalPlayer = Cast<ULocalPlayer>(Player);
+	UEnhancedInputLocalPlayerSubsystem* InputSystem = LocalPlayer ? LocalPlayer->GetSubsystem<UEnhancedInputLocalPlayerSubsystem>() : nullptr;
+	if (InputSystem == nullptr)
+	{
+		// The local player can be assigned after BeginPlay, try again until input can be bound
+		GetWorldTimerManager().SetTimerForNextTick(this, &ThisClass::TryBecomeDrivable);
+		return;
+	}
+
+	// Already loaded so this does not block
+	if (UInputMappingContext* LoadedInputMapping = InputMapping.Get())
+	{
+		InputSystem->AddMappingContext(LoadedInputMapping, 0);
+	}
+
+	bDrivable = true;
+	if (Preload)
+	{
+		Preload->NotifyDrivable();
+	}
 }
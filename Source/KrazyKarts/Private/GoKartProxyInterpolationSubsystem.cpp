@@ -0,0 +1,342 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartProxyInterpolationSubsystem.h"
+
+#include "GoKartMovementComponent.h"
+#include "KrazyKarts/KrazyKarts.h"
+#include "Math/VectorRegister.h"
+
+DECLARE_CYCLE_STAT(TEXT("Batched Proxy Interpolation"), STAT_KrazyKartsBatchedProxyInterpolation, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Interpolated Proxies"), STAT_KrazyKartsInterpolatedProxies, STATGROUP_KrazyKarts);
+
+TArray<FGoKartProxyInterpolation> FGoKartProxyInterpolation::MakeRandom(const int32 NumProxies)
+{
+	FRandomStream Random{NumProxies};
+	TArray<FGoKartProxyInterpolation> Proxies;
+	Proxies.Reserve(NumProxies);
+	for (int32 Index = 0; Index < NumProxies; ++Index)
+	{
+		FGoKartProxyInterpolation& Proxy = Proxies.AddDefaulted_GetRef();
+		Proxy.StartLocation = Random.GetUnitVector() * 10000.0;
+		Proxy.TargetLocation = Proxy.StartLocation + Random.GetUnitVector() * 100.0;
+		Proxy.StartDerivative = Random.GetUnitVector() * 200.0;
+		Proxy.TargetDerivative = Random.GetUnitVector() * 200.0;
+		Proxy.StartRotation = FQuat{Random.GetUnitVector(), Random.FRandRange(-PI, PI)};
+		Proxy.TargetRotation = Proxy.StartRotation * FQuat{FVector::UpVector, Random.FRandRange(-0.1f, 0.1f)};
+		Proxy.Alpha = Random.FRand();
+	}
+	return Proxies;
+}
+
+// ===================================================
+// BATCH
+
+void FGoKartProxyInterpolationBatch::Add(const FGoKartProxyInterpolation& Proxy)
+{
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		StartLocations[Axis].Add(Proxy.StartLocation[Axis]);
+		StartDerivatives[Axis].Add(Proxy.StartDerivative[Axis]);
+		TargetLocations[Axis].Add(Proxy.TargetLocation[Axis]);
+		TargetDerivatives[Axis].Add(Proxy.TargetDerivative[Axis]);
+	}
+
+	// Same as FQuat::Slerp, take the shortest path
+	const double Sign = (Proxy.StartRotation | Proxy.TargetRotation) < 0.0 ? -1.0 : 1.0;
+	StartRotations[0].Add(Proxy.StartRotation.X);
+	StartRotations[1].Add(Proxy.StartRotation.Y);
+	StartRotations[2].Add(Proxy.StartRotation.Z);
+	StartRotations[3].Add(Proxy.StartRotation.W);
+	TargetRotations[0].Add(Proxy.TargetRotation.X * Sign);
+	TargetRotations[1].Add(Proxy.TargetRotation.Y * Sign);
+	TargetRotations[2].Add(Proxy.TargetRotation.Z * Sign);
+	TargetRotations[3].Add(Proxy.TargetRotation.W * Sign);
+
+	Alphas.Add(Proxy.Alpha);
+}
+
+void FGoKartProxyInterpolationBatch::Reset()
+{
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		StartLocations[Axis].Reset();
+		StartDerivatives[Axis].Reset();
+		TargetLocations[Axis].Reset();
+		TargetDerivatives[Axis].Reset();
+	}
+	for (int32 Component = 0; Component < 4; ++Component)
+	{
+		StartRotations[Component].Reset();
+		TargetRotations[Component].Reset();
+	}
+	Alphas.Reset();
+}
+
+void FGoKartProxyInterpolationBatch::Evaluate()
+{
+	const int32 Count = Num();
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		Locations[Axis].SetNumUninitialized(Count, false);
+		Derivatives[Axis].SetNumUninitialized(Count, false);
+	}
+	for (int32 Component = 0; Component < 4; ++Component)
+	{
+		Rotations[Component].SetNumUninitialized(Count, false);
+	}
+
+	EvaluateHermite();
+	EvaluateNlerp();
+}
+
+void FGoKartProxyInterpolationBatch::EvaluateHermite()
+{
+	// https://en.wikipedia.org/wiki/Cubic_Hermite_spline
+	// Each register holds the same component of 4 proxies, so the basis functions are computed for 4 curves at once
+	const int32 Count = Num();
+	const int32 NumVectorized = Count & ~3;
+
+	const VectorRegister4Double One = VectorSetFloat1(1.0);
+	const VectorRegister4Double Two = VectorSetFloat1(2.0);
+	const VectorRegister4Double Three = VectorSetFloat1(3.0);
+	const VectorRegister4Double Four = VectorSetFloat1(4.0);
+	const VectorRegister4Double Six = VectorSetFloat1(6.0);
+
+	for (int32 Index = 0; Index < NumVectorized; Index += 4)
+	{
+		const VectorRegister4Double A = VectorLoad(&Alphas[Index]);
+		const VectorRegister4Double A2 = VectorMultiply(A, A);
+		const VectorRegister4Double A3 = VectorMultiply(A2, A);
+
+		// Position basis
+		const VectorRegister4Double H00 = VectorAdd(VectorSubtract(VectorMultiply(Two, A3), VectorMultiply(Three, A2)), One);
+		const VectorRegister4Double H10 = VectorAdd(VectorSubtract(A3, VectorMultiply(Two, A2)), A);
+		const VectorRegister4Double H01 = VectorSubtract(One, H00);
+		const VectorRegister4Double H11 = VectorSubtract(A3, A2);
+
+		// First derivative basis
+		const VectorRegister4Double D00 = VectorMultiply(Six, VectorSubtract(A2, A));
+		const VectorRegister4Double D10 = VectorAdd(VectorSubtract(VectorMultiply(Three, A2), VectorMultiply(Four, A)), One);
+		const VectorRegister4Double D11 = VectorSubtract(VectorMultiply(Three, A2), VectorMultiply(Two, A));
+
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			const VectorRegister4Double P0 = VectorLoad(&StartLocations[Axis][Index]);
+			const VectorRegister4Double T0 = VectorLoad(&StartDerivatives[Axis][Index]);
+			const VectorRegister4Double P1 = VectorLoad(&TargetLocations[Axis][Index]);
+			const VectorRegister4Double T1 = VectorLoad(&TargetDerivatives[Axis][Index]);
+
+			VectorRegister4Double Location = VectorMultiply(H00, P0);
+			Location = VectorMultiplyAdd(H10, T0, Location);
+			Location = VectorMultiplyAdd(H01, P1, Location);
+			Location = VectorMultiplyAdd(H11, T1, Location);
+
+			VectorRegister4Double Derivative = VectorMultiply(D00, VectorSubtract(P0, P1));
+			Derivative = VectorMultiplyAdd(D10, T0, Derivative);
+			Derivative = VectorMultiplyAdd(D11, T1, Derivative);
+
+			VectorStore(Location, &Locations[Axis][Index]);
+			VectorStore(Derivative, &Derivatives[Axis][Index]);
+		}
+	}
+
+	// Remaining proxies when the count is not a multiple of 4
+	for (int32 Index = NumVectorized; Index < Count; ++Index)
+	{
+		const double A = Alphas[Index];
+		const double A2 = A * A;
+		const double A3 = A2 * A;
+
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			const double P0 = StartLocations[Axis][Index];
+			const double T0 = StartDerivatives[Axis][Index];
+			const double P1 = TargetLocations[Axis][Index];
+			const double T1 = TargetDerivatives[Axis][Index];
+
+			Locations[Axis][Index] = (2.0 * A3 - 3.0 * A2 + 1.0) * P0 + (A3 - 2.0 * A2 + A) * T0 + (A3 - A2) * T1 + (3.0 * A2 - 2.0 * A3) * P1;
+			Derivatives[Axis][Index] = (6.0 * A2 - 6.0 * A) * (P0 - P1) + (3.0 * A2 - 4.0 * A + 1.0) * T0 + (3.0 * A2 - 2.0 * A) * T1;
+		}
+	}
+}
+
+void FGoKartProxyInterpolationBatch::EvaluateNlerp()
+{
+	// Close to slerp for the small angles covered between two replications and much cheaper (no trigonometry)
+	const int32 Count = Num();
+	const int32 NumVectorized = Count & ~3;
+
+	for (int32 Index = 0; Index < NumVectorized; Index += 4)
+	{
+		const VectorRegister4Double A = VectorLoad(&Alphas[Index]);
+
+		VectorRegister4Double Rotation[4];
+		VectorRegister4Double SizeSquared = VectorZeroDouble();
+		for (int32 Component = 0; Component < 4; ++Component)
+		{
+			const VectorRegister4Double Q0 = VectorLoad(&StartRotations[Component][Index]);
+			const VectorRegister4Double Q1 = VectorLoad(&TargetRotations[Component][Index]);
+			Rotation[Component] = VectorMultiplyAdd(A, VectorSubtract(Q1, Q0), Q0);
+			SizeSquared = VectorMultiplyAdd(Rotation[Component], Rotation[Component], SizeSquared);
+		}
+
+		const VectorRegister4Double InvSize = VectorReciprocalSqrt(SizeSquared);
+		for (int32 Component = 0; Component < 4; ++Component)
+		{
+			VectorStore(VectorMultiply(Rotation[Component], InvSize), &Rotations[Component][Index]);
+		}
+	}
+
+	// Remaining proxies when the count is not a multiple of 4
+	for (int32 Index = NumVectorized; Index < Count; ++Index)
+	{
+		double Rotation[4];
+		double SizeSquared = 0.0;
+		for (int32 Component = 0; Component < 4; ++Component)
+		{
+			const double Q0 = StartRotations[Component][Index];
+			Rotation[Component] = Q0 + Alphas[Index] * (TargetRotations[Component][Index] - Q0);
+			SizeSquared += Rotation[Component] * Rotation[Component];
+		}
+
+		const double InvSize = FMath::InvSqrt(SizeSquared);
+		for (int32 Component = 0; Component < 4; ++Component)
+		{
+			Rotations[Component][Index] = Rotation[Component] * InvSize;
+		}
+	}
+}
+
+// ===================================================
+// SUBSYSTEM
+
+void UGoKartProxyInterpolationSubsystem::AddProxy(USceneComponent* MeshOffsetRoot, UGoKartMovementComponent* MovementComponent,
+                                                  const FGoKartProxyInterpolation& Proxy, const float VelocityToDerivative)
+{
+	MeshOffsetRoots.Add(MeshOffsetRoot);
+	MovementComponents.Add(MovementComponent);
+	VelocityToDerivatives.Add(VelocityToDerivative);
+	Batch.Add(Proxy);
+}
+
+void UGoKartProxyInterpolationSubsystem::Flush()
+{
+	const int32 Count = Batch.Num();
+	if (Count == 0)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_KrazyKartsBatchedProxyInterpolation);
+	INC_DWORD_STAT_BY(STAT_KrazyKartsInterpolatedProxies, Count);
+
+	Batch.Evaluate();
+
+	// Apply side effects
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		// The proxy could have been destroyed after it was queued
+		if (!IsValid(MeshOffsetRoots[Index]) || !IsValid(MovementComponents[Index]))
+		{
+			continue;
+		}
+
+		MeshOffsetRoots[Index]->SetWorldLocationAndRotation(Batch.GetLocation(Index), Batch.GetRotation(Index));
+		MovementComponents[Index]->SetVelocity(Batch.GetDerivative(Index) / VelocityToDerivatives[Index]);
+	}
+
+	MeshOffsetRoots.Reset();
+	MovementComponents.Reset();
+	VelocityToDerivatives.Reset();
+	Batch.Reset();
+}
+
+void UGoKartProxyInterpolationSubsystem::Tick(const float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	Flush();
+}
+
+TStatId UGoKartProxyInterpolationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartProxyInterpolationSubsystem, STATGROUP_Tickables);
+}
+
+// ===================================================
+// MICROBENCHMARK
+
+static void BenchmarkProxyInterpolation(const TArray<FString>& Args, UWorld* World)
+{
+	const int32 NumProxies = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 64;
+	const int32 NumIterations = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 1000;
+	UGoKartProxyInterpolationSubsystem* Interpolation = World ? World->GetSubsystem<UGoKartProxyInterpolationSubsystem>() : nullptr;
+	if (NumProxies <= 0 || NumIterations <= 0 || Interpolation == nullptr)
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("Usage: KrazyKarts.BenchmarkProxyInterpolation [NumProxies] [NumIterations], in a game world"));
+		return;
+	}
+
+	// Components moved by both paths, so the gather and the scatter are measured too
+	AActor* Proxies = World->SpawnActor<AActor>();
+	USceneComponent* Root = NewObject<USceneComponent>(Proxies, TEXT("Root"));
+	Proxies->SetRootComponent(Root);
+	Root->RegisterComponent();
+	TArray<USceneComponent*> MeshOffsetRoots;
+	TArray<UGoKartMovementComponent*> MovementComponents;
+	for (int32 Index = 0; Index < NumProxies; ++Index)
+	{
+		USceneComponent* MeshOffsetRoot = NewObject<USceneComponent>(Proxies);
+		MeshOffsetRoot->SetupAttachment(Root);
+		MeshOffsetRoot->RegisterComponent();
+		MeshOffsetRoots.Add(MeshOffsetRoot);
+		MovementComponents.Add(NewObject<UGoKartMovementComponent>(Proxies));
+	}
+
+	const TArray<FGoKartProxyInterpolation> Inputs = FGoKartProxyInterpolation::MakeRandom(NumProxies);
+	constexpr float VelocityToDerivative = 10.0f;
+
+	// Per component path, as done by each simulated proxy in SimulatedProxyTick
+	double StartSeconds = FPlatformTime::Seconds();
+	for (int32 Iteration = 0; Iteration < NumIterations; ++Iteration)
+	{
+		for (int32 Index = 0; Index < NumProxies; ++Index)
+		{
+			const FGoKartProxyInterpolation& Proxy = Inputs[Index];
+			const FVector NewLocation = FMath::CubicInterp(Proxy.StartLocation, Proxy.StartDerivative, Proxy.TargetLocation, Proxy.TargetDerivative, Proxy.Alpha);
+			const FVector NewVelocity = FMath::CubicInterpDerivative(Proxy.StartLocation, Proxy.StartDerivative, Proxy.TargetLocation, Proxy.TargetDerivative, Proxy.Alpha);
+			const FQuat NewRotation = FQuat::Slerp(Proxy.StartRotation, Proxy.TargetRotation, Proxy.Alpha);
+			MeshOffsetRoots[Index]->SetWorldLocation(NewLocation);
+			MeshOffsetRoots[Index]->SetWorldRotation(FRotator{NewRotation});
+			MovementComponents[Index]->SetVelocity(NewVelocity / VelocityToDerivative);
+		}
+	}
+	const double PerComponentSeconds = FPlatformTime::Seconds() - StartSeconds;
+	const FVector PerComponentLocation = MeshOffsetRoots.Last()->GetComponentLocation();
+
+	// Batched path, gather, evaluate and scatter
+	StartSeconds = FPlatformTime::Seconds();
+	for (int32 Iteration = 0; Iteration < NumIterations; ++Iteration)
+	{
+		for (int32 Index = 0; Index < NumProxies; ++Index)
+		{
+			Interpolation->AddProxy(MeshOffsetRoots[Index], MovementComponents[Index], Inputs[Index], VelocityToDerivative);
+		}
+		Interpolation->Flush();
+	}
+	const double BatchedSeconds = FPlatformTime::Seconds() - StartSeconds;
+	const FVector BatchedLocation = MeshOffsetRoots.Last()->GetComponentLocation();
+
+	Proxies->Destroy();
+
+	const double NumEvaluations = static_cast<double>(NumProxies) * NumIterations;
+	UE_LOG(LogKrazyKarts, Display, TEXT("Proxy interpolation of %i proxies x %i iterations: per component %.2f ns/proxy, batched %.2f ns/proxy (%.2fx), location error %.4f cm"),
+		NumProxies, NumIterations, PerComponentSeconds * 1e9 / NumEvaluations, BatchedSeconds * 1e9 / NumEvaluations,
+		PerComponentSeconds / FMath::Max(BatchedSeconds, UE_DOUBLE_SMALL_NUMBER), FVector::Dist(PerComponentLocation, BatchedLocation));
+}
+
+static FAutoConsoleCommandWithWorldAndArgs BenchmarkProxyInterpolationCommand(
+	TEXT("KrazyKarts.BenchmarkProxyInterpolation"),
+	TEXT("Compare the full per component and batched simulated proxy interpolation passes, gather and scatter included. Usage: KrazyKarts.BenchmarkProxyInterpolation [NumProxies] [NumIterations]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&BenchmarkProxyInterpolation));
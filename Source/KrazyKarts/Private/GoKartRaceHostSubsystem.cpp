@@ -0,0 +1,268 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartRaceHostSubsystem.h"
+
+#include "Engine/Engine.h"
+#include "Engine/GameInstance.h"
+#include "Engine/NetDriver.h"
+#include "GameMapsSettings.h"
+#include "KrazyKarts/KrazyKarts.h"
+#include "Misc/CommandLine.h"
+#include "Misc/PackageName.h"
+#include "UObject/LinkerInstancingContext.h"
+
+TWeakObjectPtr<UGoKartRaceHostSubsystem> UGoKartRaceHostSubsystem::Host;
+
+static FAutoConsoleCommand ListRaceSessionsCommand(
+	TEXT("KrazyKarts.ListRaceSessions"),
+	TEXT("Log the races hosted by this dedicated server process with their memory and tick time"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		if (const UGoKartRaceHostSubsystem* RaceHost = UGoKartRaceHostSubsystem::Get())
+		{
+			RaceHost->LogRaceSessions();
+		}
+	}));
+
+namespace
+{
+	double ToMegabytes(const uint64 Bytes)
+	{
+		return Bytes / (1024.0 * 1024.0);
+	}
+}
+
+bool UGoKartRaceHostSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	// The game instances of the extra races are created while the host exists, they must not host races themselves
+	return IsRunningDedicatedServer() && !Host.IsValid() && Super::ShouldCreateSubsystem(Outer);
+}
+
+void UGoKartRaceHostSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	Host = this;
+	FCoreUObjectDelegates::PostLoadMapWithWorld.AddUObject(this, &ThisClass::OnPostLoadMap);
+	FWorldDelegates::OnWorldTickStart.AddUObject(this, &ThisClass::OnWorldTickStart);
+	FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &ThisClass::OnWorldPostActorTick);
+}
+
+void UGoKartRaceHostSubsystem::Deinitialize()
+{
+	FCoreUObjectDelegates::PostLoadMapWithWorld.RemoveAll(this);
+	FWorldDelegates::OnWorldTickStart.RemoveAll(this);
+	FWorldDelegates::OnWorldPostActorTick.RemoveAll(this);
+
+	for (UGameInstance* GameInstance : HostedGameInstances)
+	{
+		if (UWorld* World = GameInstance->GetWorld())
+		{
+			GEngine->ShutdownWorldNetDriver(World);
+			World->DestroyWorld(false);
+			GEngine->DestroyWorldContext(World);
+		}
+		GameInstance->Shutdown();
+	}
+
+	HostedGameInstances.Reset();
+	RaceSessions.Reset();
+	Host.Reset();
+
+	Super::Deinitialize();
+}
+
+void UGoKartRaceHostSubsystem::OnPostLoadMap(UWorld* LoadedWorld)
+{
+	// Start the extra races once the first race is up, so they all share the packages it loaded
+	if (bRaceSessionsStarted || LoadedWorld == nullptr || LoadedWorld->GetGameInstance() != GetGameInstance())
+	{
+		return;
+	}
+	bRaceSessionsStarted = true;
+
+	FRaceSession& FirstRace = RaceSessions.AddDefaulted_GetRef();
+	FirstRace.GameInstance = GetGameInstance();
+	FirstRace.Port = LoadedWorld->URL.Port;
+	FirstRace.MapPackageName = LoadedWorld->GetOutermost()->GetName();
+	FirstRace.MemoryBytes = FPlatformMemory::GetStats().UsedPhysical; // Includes the engine itself
+
+	int32 NumRaceSessions = 1;
+	FParse::Value(FCommandLine::Get(), TEXT("RaceSessions="), NumRaceSessions);
+	int32 BasePort = FirstRace.Port + 1;
+	FParse::Value(FCommandLine::Get(), TEXT("RaceSessionBasePort="), BasePort);
+	FString MapName = LoadedWorld->GetOutermost()->GetName();
+	FParse::Value(FCommandLine::Get(), TEXT("RaceSessionMap="), MapName);
+	if (!FPackageName::IsValidLongPackageName(MapName) && !FPackageName::SearchForPackageOnDisk(MapName, &MapName))
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to find race map %s"), ANSI_TO_TCHAR(__FUNCTION__), *MapName);
+		return;
+	}
+
+	for (int32 Index = 1; Index < NumRaceSessions; ++Index)
+	{
+		if (!StartRaceSession(MapName, BasePort + Index - 1))
+		{
+			break;
+		}
+	}
+
+	LogRaceSessions();
+}
+
+bool UGoKartRaceHostSubsystem::StartRaceSession(const FString& MapName, const int32 Port)
+{
+	const uint64 MemoryBeforeBytes = FPlatformMemory::GetStats().UsedPhysical;
+
+	UClass* GameInstanceClass = GetDefault<UGameMapsSettings>()->GameInstanceClass.TryLoadClass<UGameInstance>();
+	if (GameInstanceClass == nullptr)
+	{
+		GameInstanceClass = UGameInstance::StaticClass();
+	}
+
+	// LoadMap reuses a map package already in memory, and with it the world of the race that loaded it. Like PIE
+	// does with its UEDPIE_N_ prefix, each race loads the map into a package of its own to get a world of its own
+	const FString InstancePackageName = FString::Printf(TEXT("%s_RaceSession%i"), *MapName, RaceSessions.Num());
+	UWorld* InstanceWorld = LoadMapInstance(MapName, InstancePackageName);
+	if (InstanceWorld == nullptr)
+	{
+		return false;
+	}
+
+	// Same as what PIE does for each instance: a game instance with its own world context
+	UGameInstance* GameInstance = NewObject<UGameInstance>(GEngine, GameInstanceClass);
+	GameInstance->InitializeStandalone(*FString::Printf(TEXT("RaceSession%i"), RaceSessions.Num()));
+
+	FURL URL{nullptr, *InstancePackageName, TRAVEL_Absolute};
+	URL.Port = Port;
+	URL.AddOption(TEXT("listen"));
+
+	// Tracked before browsing, the paths of the objects of the map are remapped as soon as the world listens
+	FRaceSession& RaceSession = RaceSessions.AddDefaulted_GetRef();
+	RaceSession.GameInstance = GameInstance;
+	RaceSession.Port = Port;
+	RaceSession.MapPackageName = MapName;
+	RaceSession.InstancePackageName = InstancePackageName;
+
+	FString Error;
+	const EBrowseReturnVal::Type BrowseResult = GEngine->Browse(*GameInstance->GetWorldContext(), URL, Error);
+	InstanceWorld->RemoveFromRoot(); // Kept by the world context from now on
+	if (BrowseResult == EBrowseReturnVal::Failure || GameInstance->GetWorld() != InstanceWorld)
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to start a race on %s port %i: %s"),
+			ANSI_TO_TCHAR(__FUNCTION__), *MapName, Port, *Error);
+		RaceSessions.Pop();
+		GameInstance->Shutdown();
+		return false;
+	}
+
+	HostedGameInstances.Add(GameInstance);
+	RaceSessions.Last().MemoryBytes = FPlatformMemory::GetStats().UsedPhysical - MemoryBeforeBytes;
+	return true;
+}
+
+UWorld* UGoKartRaceHostSubsystem::LoadMapInstance(const FString& MapName, const FString& InstancePackageName)
+{
+	FPackagePath MapPackagePath;
+	if (!FPackagePath::TryFromPackageName(MapName, MapPackagePath) || !FPackageName::DoesPackageExist(MapPackagePath, &MapPackagePath))
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to find race map %s"), ANSI_TO_TCHAR(__FUNCTION__), *MapName);
+		return nullptr;
+	}
+
+	// Same as ULevelStreamingDynamic::LoadLevelInstance, the map is loaded under another package name
+	FLinkerInstancingContext InstancingContext;
+	InstancingContext.AddPackageMapping(FName{*MapName}, FName{*InstancePackageName});
+	const int32 RequestId = LoadPackageAsync(MapPackagePath, FName{*InstancePackageName}, FLoadPackageAsyncDelegate{},
+	                                         PKG_ContainsMap, INDEX_NONE, 0, &InstancingContext);
+	FlushAsyncLoading(RequestId);
+
+	UPackage* InstancePackage = FindPackage(nullptr, *InstancePackageName);
+	UWorld* InstanceWorld = InstancePackage ? UWorld::FindWorldInPackage(InstancePackage) : nullptr;
+	if (InstanceWorld == nullptr)
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to load %s as %s"), ANSI_TO_TCHAR(__FUNCTION__), *MapName, *InstancePackageName);
+		return nullptr;
+	}
+
+	// Not referenced by anything until LoadMap makes it the world of the race
+	InstanceWorld->AddToRoot();
+	return InstanceWorld;
+}
+
+bool UGoKartRaceHostSubsystem::RemapRaceSessionPath(const UWorld* World, FString& Path, const bool bReading) const
+{
+	const UGameInstance* GameInstance = World ? World->GetGameInstance() : nullptr;
+	const FRaceSession* RaceSession = RaceSessions.FindByPredicate([GameInstance](const FRaceSession& Candidate)
+	{
+		return GameInstance != nullptr && Candidate.GameInstance.Get() == GameInstance;
+	});
+	if (RaceSession == nullptr || RaceSession->InstancePackageName.IsEmpty())
+	{
+		return false;
+	}
+
+	// Clients load the map from disk, they only know its objects by their path in the original package
+	const FString& FromPackageName = bReading ? RaceSession->MapPackageName : RaceSession->InstancePackageName;
+	const FString& ToPackageName = bReading ? RaceSession->InstancePackageName : RaceSession->MapPackageName;
+	if (!Path.StartsWith(FromPackageName) || (Path.Len() > FromPackageName.Len() && Path[FromPackageName.Len()] != TEXT('.')))
+	{
+		return false;
+	}
+
+	Path = ToPackageName + Path.RightChop(FromPackageName.Len());
+	return true;
+}
+
+UGoKartRaceHostSubsystem::FRaceSession* UGoKartRaceHostSubsystem::FindRaceSession(const UWorld* World)
+{
+	const UGameInstance* GameInstance = World ? World->GetGameInstance() : nullptr;
+	return RaceSessions.FindByPredicate([GameInstance](const FRaceSession& RaceSession)
+	{
+		return GameInstance != nullptr && RaceSession.GameInstance.Get() == GameInstance;
+	});
+}
+
+void UGoKartRaceHostSubsystem::OnWorldTickStart(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (FRaceSession* RaceSession = FindRaceSession(World))
+	{
+		RaceSession->TickStartSeconds = FPlatformTime::Seconds();
+	}
+}
+
+void UGoKartRaceHostSubsystem::OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (FRaceSession* RaceSession = FindRaceSession(World); RaceSession && RaceSession->TickStartSeconds > 0.0)
+	{
+		const double TickMilliseconds = (FPlatformTime::Seconds() - RaceSession->TickStartSeconds) * 1000.0;
+		RaceSession->AverageTickMilliseconds = FMath::Lerp(RaceSession->AverageTickMilliseconds, TickMilliseconds, 0.05);
+	}
+}
+
+void UGoKartRaceHostSubsystem::LogRaceSessions() const
+{
+	const FPlatformMemoryStats MemoryStats = FPlatformMemory::GetStats();
+	uint64 ExtraRacesMemoryBytes = 0;
+	double TotalTickMilliseconds = 0.0;
+
+	for (int32 Index = 0; Index < RaceSessions.Num(); ++Index)
+	{
+		const FRaceSession& RaceSession = RaceSessions[Index];
+		const UGameInstance* GameInstance = RaceSession.GameInstance.Get();
+		const UWorld* World = GameInstance ? GameInstance->GetWorld() : nullptr;
+		const UNetDriver* NetDriver = World ? World->GetNetDriver() : nullptr;
+
+		UE_LOG(LogKrazyKarts, Display, TEXT("Race %i on port %i: %i connections, %.1f MB%s, tick %.2f ms"),
+			Index, RaceSession.Port, NetDriver ? NetDriver->ClientConnections.Num() : 0, ToMegabytes(RaceSession.MemoryBytes),
+			Index == 0 ? TEXT(" (with engine)") : TEXT(""), RaceSession.AverageTickMilliseconds);
+
+		ExtraRacesMemoryBytes += Index > 0 ? RaceSession.MemoryBytes : 0;
+		TotalTickMilliseconds += RaceSession.AverageTickMilliseconds;
+	}
+
+	UE_LOG(LogKrazyKarts, Display, TEXT("%i races in this process, %.1f MB used, %.1f MB per extra race, %.2f ms of game thread per frame"),
+		RaceSessions.Num(), ToMegabytes(MemoryStats.UsedPhysical),
+		RaceSessions.Num() > 1 ? ToMegabytes(ExtraRacesMemoryBytes) / (RaceSessions.Num() - 1) : 0.0, TotalTickMilliseconds);
+}
@@ -0,0 +1,277 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartTelemetrySubsystem.h"
+
+#include "EngineUtils.h"
+#include "GoKartPawn.h"
+#include "HAL/PlatformFileManager.h"
+#include "KrazyKarts/KrazyKarts.h"
+#include "Misc/Paths.h"
+
+static TAutoConsoleVariable<float> CVarTelemetryRate(
+	TEXT("KrazyKarts.Telemetry.Rate"), 0.0f,
+	TEXT("Records per second of the kart telemetry stream written by the server, 0 disables it"));
+
+static TAutoConsoleVariable<float> CVarTelemetryKeyframeInterval(
+	TEXT("KrazyKarts.Telemetry.KeyframeInterval"), 5.0f,
+	TEXT("Seconds between two keyframes of the kart telemetry stream, readers can only start decoding at a keyframe"));
+
+static TAutoConsoleVariable<float> CVarTelemetryBudgetMs(
+	TEXT("KrazyKarts.Telemetry.BudgetMs"), 0.1f,
+	TEXT("Server time in milliseconds a telemetry record is allowed to cost, records exceeding it are reported as a warning"));
+
+static TAutoConsoleVariable<float> CVarTelemetryReportInterval(
+	TEXT("KrazyKarts.Telemetry.ReportInterval"), 10.0f,
+	TEXT("Seconds between two logs of the telemetry record cost while the race runs, 0 disables them"));
+
+DECLARE_CYCLE_STAT(TEXT("Write Telemetry"), STAT_KrazyKartsWriteTelemetry, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Telemetry Record (ms)"), STAT_KrazyKartsTelemetryRecord, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Telemetry Bytes"), STAT_KrazyKartsTelemetryBytes, STATGROUP_KrazyKarts);
+
+namespace
+{
+	void WriteVarUInt(TArray<uint8>& Buffer, uint32 Value)
+	{
+		while (Value >= 0x80)
+		{
+			Buffer.Add(static_cast<uint8>(Value | 0x80));
+			Value >>= 7;
+		}
+		Buffer.Add(static_cast<uint8>(Value));
+	}
+
+	// https://protobuf.dev/programming-guides/encoding/#signed-ints
+	void WriteVarInt(TArray<uint8>& Buffer, const int32 Value)
+	{
+		WriteVarUInt(Buffer, (static_cast<uint32>(Value) << 1) ^ static_cast<uint32>(Value >> 31));
+	}
+
+	template <typename T>
+	void WriteRaw(TArray<uint8>& Buffer, const T& Value)
+	{
+		Buffer.Append(reinterpret_cast<const uint8*>(&Value), sizeof(T));
+	}
+
+	FGoKartTelemetryState Quantize(const FGoKartState& State)
+	{
+		const FVector Location = State.Transform.GetLocation();
+		const FVector Velocity = State.Velocity * 100; // convert meters to centimeters
+		const FRotator Rotation = State.Transform.Rotator();
+
+		FGoKartTelemetryState Quantized;
+		int32* Value = Quantized.Values;
+		*Value++ = FMath::RoundToInt32(Location.X);
+		*Value++ = FMath::RoundToInt32(Location.Y);
+		*Value++ = FMath::RoundToInt32(Location.Z);
+		*Value++ = FMath::RoundToInt32(Velocity.X);
+		*Value++ = FMath::RoundToInt32(Velocity.Y);
+		*Value++ = FMath::RoundToInt32(Velocity.Z);
+		*Value++ = FMath::RoundToInt32(Rotation.Pitch * 100);
+		*Value++ = FMath::RoundToInt32(Rotation.Yaw * 100);
+		*Value++ = FMath::RoundToInt32(Rotation.Roll * 100);
+		*Value++ = FMath::RoundToInt32(State.LastMove.Throttle * 1000);
+		*Value++ = FMath::RoundToInt32(State.LastMove.SteeringThrow * 1000);
+		return Quantized;
+	}
+}
+
+void UGoKartTelemetrySubsystem::Deinitialize()
+{
+	if (Stream.IsValid())
+	{
+		ReportRecordCost();
+		UE_LOG(LogKrazyKarts, Log, TEXT("[%s] Wrote %i telemetry records, %lld bytes"), ANSI_TO_TCHAR(__FUNCTION__), NumRecords, Stream->Size());
+
+		Stream.Reset(); // Closes the file
+	}
+
+	Super::Deinitialize();
+}
+
+void UGoKartTelemetrySubsystem::Tick(const float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	// Only the server knows the state of every kart
+	const float Rate = CVarTelemetryRate.GetValueOnGameThread();
+	if (Rate <= 0.0f || bStreamFailed || GetWorld()->GetNetMode() == NM_Client)
+	{
+		return;
+	}
+
+	// The port tells apart the races hosted by the same process, see UGoKartRaceHostSubsystem
+	if (!Stream.IsValid() && !OpenStream(FPaths::ProjectSavedDir() / TEXT("Telemetry") /
+		FString::Printf(TEXT("%s_%i_%s.kktl"), *GetWorld()->GetMapName(), GetWorld()->URL.Port, *FDateTime::Now().ToString()), Rate))
+	{
+		return;
+	}
+
+	TimeSinceLastRecord += DeltaTime;
+	TimeSinceLastKeyframe += DeltaTime;
+	const float RecordInterval = 1.0f / Rate;
+	if (TimeSinceLastRecord < RecordInterval)
+	{
+		return;
+	}
+
+	// Keep the time past the interval so the configured rate holds whatever the server tick rate, at most one
+	// interval so a hitch does not make the next frames write records back to back
+	TimeSinceLastRecord = FMath::Min(TimeSinceLastRecord - RecordInterval, RecordInterval);
+
+	const bool bKeyframe = NumRecords == 0 || TimeSinceLastKeyframe >= CVarTelemetryKeyframeInterval.GetValueOnGameThread();
+	if (bKeyframe)
+	{
+		TimeSinceLastKeyframe = 0.0f;
+	}
+
+	WriteRecord(bKeyframe);
+
+	const float ReportInterval = CVarTelemetryReportInterval.GetValueOnGameThread();
+	if (ReportInterval > 0.0f && NumReportedRecords >= FMath::CeilToInt32(ReportInterval * Rate))
+	{
+		ReportRecordCost();
+	}
+}
+
+TStatId UGoKartTelemetrySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartTelemetrySubsystem, STATGROUP_Tickables);
+}
+
+bool UGoKartTelemetrySubsystem::OpenStream(const FString& FileName, const float Rate)
+{
+	// Readers are allowed to follow the file while it is being written. A plain file handle, unlike a file writer
+	// archive it has no buffer to flush, so records are never synced to disk on the game thread
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(FileName));
+	Stream.Reset(PlatformFile.OpenWrite(*FileName, false, true));
+	if (!Stream.IsValid())
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("[%s] Unable to open telemetry stream %s"), ANSI_TO_TCHAR(__FUNCTION__), *FileName);
+		bStreamFailed = true;
+		return false;
+	}
+
+	RecordBuffer.Reset();
+	RecordBuffer.Append(reinterpret_cast<const uint8*>("KKTL"), 4);
+	WriteRaw(RecordBuffer, Version);
+	WriteRaw(RecordBuffer, static_cast<uint16>(0));
+	WriteRaw(RecordBuffer, Rate);
+	Stream->Write(RecordBuffer.GetData(), RecordBuffer.Num());
+
+	UE_LOG(LogKrazyKarts, Log, TEXT("[%s] Writing telemetry to %s"), ANSI_TO_TCHAR(__FUNCTION__), *FileName);
+	return true;
+}
+
+void UGoKartTelemetrySubsystem::WriteRecord(const bool bKeyframe)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KrazyKartsWriteTelemetry);
+	const double StartSeconds = FPlatformTime::Seconds();
+
+	KartStates.Reset();
+	for (const AGoKartPawn* Kart : TActorRange<AGoKartPawn>(GetWorld()))
+	{
+		const UGoKartMovementReplicationComponent* Replication = Kart->FindComponentByClass<UGoKartMovementReplicationComponent>();
+		if (Replication == nullptr)
+		{
+			continue;
+		}
+
+		uint32* KartId = KartIds.Find(Kart);
+		if (KartId == nullptr)
+		{
+			KartId = &KartIds.Add(Kart, NextKartId++);
+		}
+		KartStates.Emplace(*KartId, Replication->GetServerState());
+	}
+
+	WriteRecord(GetWorld()->GetTimeSeconds(), bKeyframe, KartStates);
+
+	// The gather is part of the record cost
+	const double RecordSeconds = FPlatformTime::Seconds() - StartSeconds;
+	ReportedRecordSeconds += RecordSeconds;
+	MaxReportedRecordSeconds = FMath::Max(MaxReportedRecordSeconds, RecordSeconds);
+	++NumReportedRecords;
+	if (RecordSeconds * 1000.0 > CVarTelemetryBudgetMs.GetValueOnGameThread())
+	{
+		++NumReportedRecordsOverBudget;
+	}
+	SET_FLOAT_STAT(STAT_KrazyKartsTelemetryRecord, RecordSeconds * 1000.0);
+}
+
+void UGoKartTelemetrySubsystem::WriteRecord(const double ServerTime, const bool bKeyframe, const TConstArrayView<TPair<uint32, FGoKartState>> States)
+{
+	// Type and payload size are patched once the payload is known
+	constexpr int32 RecordHeaderSize = sizeof(uint8) + sizeof(uint32);
+	RecordBuffer.Reset();
+	RecordBuffer.AddZeroed(RecordHeaderSize);
+	WriteRaw(RecordBuffer, ServerTime);
+
+	// Reserve the max varint size for the kart count, patched below
+	const int32 NumKartsOffset = RecordBuffer.Num();
+	RecordBuffer.AddZeroed(5);
+
+	if (bKeyframe)
+	{
+		PreviousStates.Reset();
+	}
+
+	for (const TPair<uint32, FGoKartState>& KartState : States)
+	{
+		const FGoKartTelemetryState State = Quantize(KartState.Value);
+		FGoKartTelemetryState& Previous = PreviousStates.FindOrAdd(KartState.Key);
+
+		WriteVarUInt(RecordBuffer, KartState.Key);
+		for (int32 Index = 0; Index < FGoKartTelemetryState::NumValues; ++Index)
+		{
+			WriteVarInt(RecordBuffer, State.Values[Index] - Previous.Values[Index]);
+		}
+
+		Previous = State;
+	}
+
+	// Patch the kart count as a fixed 5 bytes varint so the payload does not need to move
+	const uint32 NumKarts = States.Num();
+	for (int32 Byte = 0; Byte < 5; ++Byte)
+	{
+		RecordBuffer[NumKartsOffset + Byte] = static_cast<uint8>(((NumKarts >> (7 * Byte)) & 0x7F) | (Byte < 4 ? 0x80 : 0x00));
+	}
+
+	const uint32 PayloadSize = RecordBuffer.Num() - RecordHeaderSize;
+	RecordBuffer[0] = bKeyframe ? 0 : 1;
+	FMemory::Memcpy(&RecordBuffer[1], &PayloadSize, sizeof(PayloadSize));
+
+	// Written at once so a reader following the file only sees complete records, it does not need them on disk
+	Stream->Write(RecordBuffer.GetData(), RecordBuffer.Num());
+
+	++NumRecords;
+	INC_DWORD_STAT_BY(STAT_KrazyKartsTelemetryBytes, RecordBuffer.Num());
+}
+
+void UGoKartTelemetrySubsystem::ReportRecordCost()
+{
+	if (NumReportedRecords == 0)
+	{
+		return;
+	}
+
+	const float BudgetMs = CVarTelemetryBudgetMs.GetValueOnGameThread();
+	const double AverageMs = ReportedRecordSeconds * 1000.0 / NumReportedRecords;
+	const double MaxMs = MaxReportedRecordSeconds * 1000.0;
+	if (NumReportedRecordsOverBudget > 0)
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("[%s] Telemetry over budget, %i of %i records over %.4f ms for %i karts (average %.4f ms, max %.4f ms)"),
+			ANSI_TO_TCHAR(__FUNCTION__), NumReportedRecordsOverBudget, NumReportedRecords, BudgetMs, KartStates.Num(), AverageMs, MaxMs);
+	}
+	else
+	{
+		UE_LOG(LogKrazyKarts, Log, TEXT("[%s] %i telemetry records for %i karts, average %.4f ms, max %.4f ms (budget %.4f ms)"),
+			ANSI_TO_TCHAR(__FUNCTION__), NumReportedRecords, KartStates.Num(), AverageMs, MaxMs, BudgetMs);
+	}
+
+	NumReportedRecords = 0;
+	NumReportedRecordsOverBudget = 0;
+	ReportedRecordSeconds = 0.0;
+	MaxReportedRecordSeconds = 0.0;
+}
@@ -0,0 +1,48 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "GoKartBenchmarkCommandlet.generated.h"
+
+class FJsonObject;
+class UGoKartMovementComponent;
+class UGoKartMovementReplicationComponent;
+
+/**
+ * Measures the movement, reconciliation, interpolation and telemetry hot paths and writes the results as JSON.
+ * When a baseline is given any result worse than the baseline by more than the tolerance fails the run.
+ *
+ * UnrealEditor-Cmd KrazyKarts.uproject -run=GoKartBenchmark -nullrhi -unattended
+ *     [-Output=<results.json>] [-Baseline=<baseline.json>] [-Tolerance=0.15] [-Iterations=2000] [-Repetitions=5]
+ */
+UCLASS()
+class KRAZYKARTS_API UGoKartBenchmarkCommandlet final : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UGoKartBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	// Best time in nanoseconds of a single call to Function over all repetitions
+	double MeasureNanoseconds(TFunctionRef<void()> Function) const;
+
+	void AddResult(const FString& Name, double Value, const FString& Unit);
+
+	// True if no result regressed compared to the baseline file, false if it can not be read or any of its results is missing
+	bool CompareWithBaseline(const FString& BaselineFileName, float Tolerance) const;
+
+	UPROPERTY()
+	TObjectPtr<UGoKartMovementComponent> MovementComponent;
+
+	UPROPERTY()
+	TObjectPtr<UGoKartMovementReplicationComponent> ReplicationComponent;
+
+	TSharedPtr<FJsonObject> Results;
+	int32 Iterations{2000};
+	int32 Repetitions{5};
+};
@@ -0,0 +1,20 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/GameEngine.h"
+#include "GoKartGameEngine.generated.h"
+
+/**
+ * Game engine of KrazyKarts, set as GameEngine in DefaultEngine.ini
+ */
+UCLASS()
+class KRAZYKARTS_API UGoKartGameEngine final : public UGameEngine
+{
+	GENERATED_BODY()
+
+public:
+	// Also remaps the map of the extra races hosted by UGoKartRaceHostSubsystem
+	virtual bool NetworkRemapPath(UNetConnection* Connection, FString& Str, bool bReading = true) override;
+};
@@ -0,0 +1,57 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "GoKartJoinPreloadSubsystem.generated.h"
+
+struct FStreamableHandle;
+
+/**
+ * Client only. Streams the kart assets as soon as a map starts loading (joining a server or travelling) so
+ * they are ready before the kart is spawned, and measures the join-to-drivable latency from that moment.
+ * The assets are listed in the [/Script/KrazyKarts.GoKartJoinPreloadSubsystem] section of DefaultGame.ini.
+ */
+UCLASS(Config=Game)
+class KRAZYKARTS_API UGoKartJoinPreloadSubsystem final : public UGameInstanceSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	// Start streaming the join assets, does nothing if they are already streaming. Called when a map starts
+	// loading, and by the local player controller in case no map load was seen (e.g. play in editor)
+	void StartPreload();
+
+	bool AreJoinAssetsLoaded() const { return bJoinAssetsLoaded; }
+
+	// Platform seconds at which the current join started
+	double GetJoinStartSeconds() const { return JoinStartSeconds; }
+
+	// Called by the local player controller once the kart can be driven, reports the join latency
+	void NotifyDrivable();
+
+	// Broadcast when the join assets finished streaming
+	FSimpleMulticastDelegate OnJoinAssetsLoaded;
+
+private:
+	void OnPreLoadMap(const FString& MapName);
+	void OnPreloadCompleted();
+
+	// Kart blueprint, loading it also loads the meshes and input actions it references
+	UPROPERTY(Config)
+	TSoftClassPtr<APawn> KartPawnClass;
+
+	// Any other asset needed before the kart is drivable (input mapping, input actions...)
+	UPROPERTY(Config)
+	TArray<TSoftObjectPtr<UObject>> PreloadAssets;
+
+	TSharedPtr<FStreamableHandle> PreloadHandle; // Keeps the preloaded assets alive
+	double JoinStartSeconds{0.0};
+	bool bJoinAssetsLoaded{false};
+	bool bDrivableReported{false};
+};
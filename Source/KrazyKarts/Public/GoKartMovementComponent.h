@@ -40,9 +40,37 @@ struct FGoKartMove
 			UE_LOG(LogKrazyKarts, Error, TEXT("Invalid SteeringThrow == %f"), SteeringThrow)
 			return false;
 		}
+
+		// A move must advance time, otherwise a client could send any number of them
+		if (DeltaTime <= 0.0f)
+		{
+			UE_LOG(LogKrazyKarts, Error, TEXT("Invalid DeltaTime == %f"), DeltaTime)
+			return false;
+		}
 		
 		return true;
 	}
+
+	// True if both moves have nearly the same input so they can be sent as a single longer move
+	bool CanCoalesceWith(const FGoKartMove& Other, const float InputTolerance) const
+	{
+		return FMath::IsNearlyEqual(Throttle, Other.Throttle, InputTolerance)
+			&& FMath::IsNearlyEqual(SteeringThrow, Other.SteeringThrow, InputTolerance);
+	}
+
+	// Merge the next move into this one, input is weighted by the delta time of each move
+	void Coalesce(const FGoKartMove& Next)
+	{
+		const float TotalDeltaTime = DeltaTime + Next.DeltaTime;
+		if (TotalDeltaTime > KINDA_SMALL_NUMBER)
+		{
+			Throttle = (Throttle * DeltaTime + Next.Throttle * Next.DeltaTime) / TotalDeltaTime;
+			SteeringThrow = (SteeringThrow * DeltaTime + Next.SteeringThrow * Next.DeltaTime) / TotalDeltaTime;
+		}
+
+		DeltaTime = TotalDeltaTime;
+		Time = Next.Time; // The server acknowledges the merged move using the time of its newest frame
+	}
 };
 
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
@@ -65,6 +93,10 @@ public:
 
 	// Update actor transform from move data
 	void SimulateMoveTick(const FGoKartMove& Move);
+
+	// Same as SimulateMoveTick but split in sub-steps no longer than MaxSimulationStep, a coalesced move
+	// covers several frames and must integrate the same way when predicted, on the server and when replayed
+	void SimulateMove(const FGoKartMove& Move);
 	void SetSteeringThrow(const float Value) { SteeringThrow = Value; }
 	void SetThrottle(const float Value) { Throttle = Value; }
 	void SetVelocity(const FVector& InVelocity) { Velocity = InVelocity; }
@@ -111,6 +143,18 @@ private:
 		meta = (ClampMin = "0.0", ClampMax = "1.0", UIMin = "0.0", UIMax = "1.0"))
 	float DragCoefficient{0.5};
 
+	/**
+	 * Longest step used to integrate a move, unit is s (seconds)
+	 */
+	UPROPERTY(EditAnywhere, Category="Gameplay", meta = (ClampMin = "0.001", UIMin = "0.001"))
+	float MaxSimulationStep{1.0f / 60.0f};
+
+	/**
+	 * Max sub-steps of a single move, longer moves use longer steps so a huge DeltaTime can not stall the frame
+	 */
+	UPROPERTY(EditAnywhere, Category="Gameplay", meta = (ClampMin = "1", UIMin = "1"))
+	int32 MaxSimulationSteps{16};
+
 	/**
 	 * Factor to apply when reflecting the velocity
 	 */
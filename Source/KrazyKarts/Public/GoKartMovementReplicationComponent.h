@@ -27,6 +27,9 @@ class KRAZYKARTS_API UGoKartMovementReplicationComponent final : public UActorCo
 {
 	GENERATED_BODY()
 
+	// Drives the private hot paths to measure them
+	friend class UGoKartBenchmarkCommandlet;
+
 public:
 	// Sets default values for this component's properties
 	UGoKartMovementReplicationComponent();
@@ -38,19 +41,61 @@ protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
+	// Called when the game ends or the component is destroyed
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType,
 	                           FActorComponentTickFunction* ThisTickFunction) override;
 
+	// Last state simulated by the server, the one replicated to clients
+	const FGoKartState& GetServerState() const { return ServerState; }
+
+	// Moves received from the owning client and waiting to be simulated @ Authoritative
+	int32 GetServerMoveQueueDepth() const { return ServerMoveQueue.Num(); }
+
+	// Moves merged into others because the owning client exceeded its budget @ Authoritative
+	int32 GetNumThrottledServerMoves() const { return NumThrottledServerMoves; }
+
+	// Log the move queue of the owning client, used by KrazyKarts.ListServerMoveQueues @ Authoritative
+	void LogServerMoveQueue() const;
+
+	// Smoothed time in seconds between sending a move and receiving its acknowledgment @ AutonomousProxy
+	float GetRoundTripTime() const { return RoundTripTime; }
+
+	// Smoothed variation in seconds of the round trip time @ AutonomousProxy
+	float GetRoundTripTimeJitter() const { return RoundTripTimeJitter; }
+
+	// Percentage of packets lost between this client and the server @ AutonomousProxy
+	float GetPacketLoss() const { return PacketLoss; }
+
+	// Moves per second sent to the server, adapted to the connection quality @ AutonomousProxy
+	float GetAdaptiveNetSendRate() const { return AdaptiveNetSendRate; }
+
+	// Extra time in seconds added to the interpolation between two server states @ SimulatedProxy
+	float GetInterpolationDelay() const { return InterpolationDelay; }
+
 private:
 	// Remove movements that were already handled and confirmed by the server @ AutonomousProxy
 	void ClearUnacknowledgedMoves(const FGoKartMove& LastServerMove);
 
+	// Update the round trip time, jitter and loss from the acknowledged move and adapt the send rate @ AutonomousProxy
+	void UpdateConnectionQuality(const FGoKartMove& LastServerMove);
+
+	// Merge the frame move into the pending move, predict the merged move and send it once it is due @ AutonomousProxy
+	void CoalesceAndSendMove(const FGoKartMove& FrameMove);
+
+	// Buffer the move as unacknowledged and send it to the server @ AutonomousProxy
+	void SendMove(const FGoKartMove& Move);
+
 	// Helper called on the server to update the server state data which is replicated
 	// to the clients @ Authoritative
 	void UpdateServerState(const FGoKartMove& Move);
 
+	// Simulate the queued client moves within the frame budget and rate limit @ Authoritative
+	void ProcessServerMoveQueue(float DeltaTime);
+
 	// Called every frame only on SimulatedProxy clients
 	void SimulatedProxyTick(float DeltaTime);
 
@@ -75,7 +120,64 @@ private:
 
 	// If true location and velocity on simulated proxies will be interpolated using cubic interpolation, otherwise we interpolate using linear
 	UPROPERTY(EditDefaultsOnly)
-	bool bSimulatedProxyUsesCubicInterpolation{true}; 
+	bool bSimulatedProxyUsesCubicInterpolation{true};
+
+	// Max moves per second sent to the server by the autonomous proxy, consecutive frames are merged into a single move
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "1.0", UIMin = "1.0"))
+	float ClientNetSendRate{30.0f};
+
+	// Moves per second sent to the server by the autonomous proxy on a bad connection
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "1.0", UIMin = "1.0"))
+	float MinClientNetSendRate{10.0f};
+
+	// Round trip time in seconds from which the connection is considered bad
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "0.01", UIMin = "0.01"))
+	float BadConnectionRoundTripTime{0.3f};
+
+	// Round trip time jitter in seconds from which the connection is considered bad
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "0.001", UIMin = "0.001"))
+	float BadConnectionJitter{0.05f};
+
+	// Packet loss percentage from which the connection is considered bad
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "0.1", UIMin = "0.1"))
+	float BadConnectionPacketLoss{5.0f};
+
+	// Round trip times measured before the send rate adapts to the connection quality
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "1", UIMin = "1"))
+	int32 MinConnectionQualitySamples{8};
+
+	// Bounds in seconds of the delay added to the simulated proxy interpolation to absorb the jitter of server updates
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "0.0", UIMin = "0.0"))
+	float MinInterpolationDelay{0.0f};
+
+	UPROPERTY(EditDefaultsOnly, Category="Networking", meta = (ClampMin = "0.0", UIMin = "0.0"))
+	float MaxInterpolationDelay{0.1f};
+
+	// Max difference of throttle and steering between two frames to merge them into the same move, frames with
+	// a different input are still merged until the pending move covers 1 / ClientNetSendRate seconds
+	UPROPERTY(EditDefaultsOnly, Category="Networking",
+		meta = (ClampMin = "0.0", ClampMax = "1.0", UIMin = "0.0", UIMax = "1.0"))
+	float MoveCoalescingInputTolerance{0.05f};
+
+	// Max client moves simulated per frame for this connection
+	UPROPERTY(EditDefaultsOnly, Category="Networking|Server", meta = (ClampMin = "1", UIMin = "1"))
+	int32 MaxServerMovesPerFrame{8};
+
+	// CPU time in milliseconds this connection can spend simulating moves per frame
+	UPROPERTY(EditDefaultsOnly, Category="Networking|Server", meta = (ClampMin = "0.0", UIMin = "0.0"))
+	float ServerMoveBudgetMs{0.5f};
+
+	// Sustained moves per second a client is allowed to simulate (token bucket refill rate)
+	UPROPERTY(EditDefaultsOnly, Category="Networking|Server", meta = (ClampMin = "1.0", UIMin = "1.0"))
+	float ServerMoveRate{60.0f};
+
+	// Moves a client can burst above the sustained rate (token bucket capacity)
+	UPROPERTY(EditDefaultsOnly, Category="Networking|Server", meta = (ClampMin = "1.0", UIMin = "1.0"))
+	float ServerMoveBurst{30.0f};
+
+	// Max moves queued for this connection, moves received while the queue is full are merged into the last one
+	UPROPERTY(EditDefaultsOnly, Category="Networking|Server", meta = (ClampMin = "1", UIMin = "1"))
+	int32 MaxQueuedServerMoves{32};
 
 	UPROPERTY()
 	TObjectPtr<USceneComponent> MeshOffsetRoot;
@@ -83,10 +185,29 @@ private:
 	UPROPERTY()
 	TObjectPtr<UGoKartMovementComponent> MovementComponent; // Cache the movement component
 	TArray<FGoKartMove> UnacknowledgedMoves; // Only for autonomous proxies
+	FGoKartMove PendingMove; // Only for autonomous proxies, frames simulated locally but not sent yet
+	FTransform PendingMoveStartTransform; // Only for autonomous proxies, state the pending move is simulated from
+	FVector PendingMoveStartVelocity{0}; // Only for autonomous proxies
+	int32 NumPredictedFrames{0}; // Only for autonomous proxies
+	int32 NumSentMoves{0}; // Only for autonomous proxies
+	TArray<TPair<float, double>> MoveSendTimes; // Only for autonomous proxies, platform seconds at which each unacknowledged move was sent
+	int32 NumRoundTripTimeSamples{0}; // Only for autonomous proxies
+	float RoundTripTime{0.0f}; // Only for autonomous proxies
+	float RoundTripTimeJitter{0.0f}; // Only for autonomous proxies
+	float PacketLoss{0.0f}; // Only for autonomous proxies
+	float AdaptiveNetSendRate{0.0f}; // Only for autonomous proxies
 	FTransform StartTransformForSimulatedProxy; // Only for simulated proxies
 	FVector StartVelocityForSimulatedProxy; // Only for simulated proxies
 	float ClientTimeSinceLastReplication{0.0f}; // Only for simulated proxies
-	float ClientTimeBetweenLastReplication{0.0f}; // Only for simulated proxies
-
-	float ClientSimulatedTime; // Only on server, tracks the time simulated by the client
+	float ClientTimeBetweenLastReplication{0.0f}; // Only for simulated proxies, replication interval plus interpolation delay
+	float ClientReplicationInterval{0.0f}; // Only for simulated proxies, time between the last two server states
+	float AverageReplicationInterval{0.0f}; // Only for simulated proxies
+	float ReplicationIntervalJitter{0.0f}; // Only for simulated proxies
+	float InterpolationDelay{0.0f}; // Only for simulated proxies
+
+	float ClientSimulatedTime{0.0f}; // Only on server, tracks the time simulated by the client
+	TArray<FGoKartMove> ServerMoveQueue; // Only on server, moves received but not simulated yet
+	float ServerMoveTokens{0.0f}; // Only on server, token bucket used to rate limit the client
+	int32 NumThrottledServerMoves{0}; // Only on server
+	float TimeSinceServerMoveQueueLog{0.0f}; // Only on server
 };
@@ -7,9 +7,11 @@
 #include "GoKartPlayerController.generated.h"
 
 class UInputMappingContext;
+struct FStreamableHandle;
 
 // https://docs.unrealengine.com/5.1/en-US/input-overview-in-unreal-engine/
 // https://docs.unrealengine.com/5.1/en-US/enhanced-input-in-unreal-engine/
+// https://docs.unrealengine.com/5.1/en-US/asynchronous-asset-loading-in-unreal-engine/
 /**
  * 
  */
@@ -18,11 +20,27 @@ class KRAZYKARTS_API AGoKartPlayerController : public APlayerController
 {
 	GENERATED_BODY()
 
+public:
+	// Called on the owning client when the possessed pawn is acknowledged
+	virtual void AcknowledgePossession(APawn* P) override;
+
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	
 private:
+	// Called when the input mapping finished streaming
+	void OnInputMappingLoaded();
+
+	// Add the input mapping once the join assets, the input mapping and the pawn are ready
+	void TryBecomeDrivable();
+
 	// Expose a mapping context as a property in your header file...
 	UPROPERTY(EditAnywhere, Category="Input")
 	TSoftObjectPtr<UInputMappingContext> InputMapping;
+
+	TSharedPtr<FStreamableHandle> InputMappingHandle;
+	FDelegateHandle JoinAssetsLoadedHandle;
+	bool bInputMappingLoaded{false};
+	bool bDrivable{false};
 };
@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartProxyInterpolationSubsystem.generated.h"
+
+class UGoKartMovementComponent;
+
+/**
+ * Inputs of the interpolation of a single simulated proxy, see UGoKartMovementReplicationComponent::SimulatedProxyTick
+ */
+struct KRAZYKARTS_API FGoKartProxyInterpolation
+{
+	FVector StartLocation{0};
+	FVector StartDerivative{0};
+	FVector TargetLocation{0};
+	FVector TargetDerivative{0};
+	FQuat StartRotation{FQuat::Identity};
+	FQuat TargetRotation{FQuat::Identity};
+	double Alpha{0.0};
+
+	// Random but deterministic proxies shared by the interpolation benchmarks
+	static TArray<FGoKartProxyInterpolation> MakeRandom(int32 NumProxies);
+};
+
+/**
+ * Interpolation of many simulated proxies stored as a structure of arrays, one array per component,
+ * so the kernels evaluate 4 proxies per vector register
+ */
+struct KRAZYKARTS_API FGoKartProxyInterpolationBatch
+{
+	void Add(const FGoKartProxyInterpolation& Proxy);
+	void Reset();
+	int32 Num() const { return Alphas.Num(); }
+
+	// Same as FMath::CubicInterp, FMath::CubicInterpDerivative and a normalized lerp of the rotation for all the proxies
+	void Evaluate();
+
+	FVector GetLocation(const int32 Index) const { return FVector{Locations[0][Index], Locations[1][Index], Locations[2][Index]}; }
+	FVector GetDerivative(const int32 Index) const { return FVector{Derivatives[0][Index], Derivatives[1][Index], Derivatives[2][Index]}; }
+	FQuat GetRotation(const int32 Index) const { return FQuat{Rotations[0][Index], Rotations[1][Index], Rotations[2][Index], Rotations[3][Index]}; }
+
+private:
+	void EvaluateHermite();
+	void EvaluateNlerp();
+
+	// Inputs, X Y Z (and W) components in separate arrays
+	TArray<double> StartLocations[3];
+	TArray<double> StartDerivatives[3];
+	TArray<double> TargetLocations[3];
+	TArray<double> TargetDerivatives[3];
+	TArray<double> StartRotations[4];
+	TArray<double> TargetRotations[4];
+	TArray<double> Alphas;
+
+	// Results, kept between frames to avoid reallocating
+	TArray<double> Locations[3];
+	TArray<double> Derivatives[3];
+	TArray<double> Rotations[4];
+};
+
+/**
+ * Gathers the interpolation of every simulated proxy during the frame into a FGoKartProxyInterpolationBatch,
+ * then evaluates all of them at once and scatters the results back
+ */
+UCLASS()
+class KRAZYKARTS_API UGoKartProxyInterpolationSubsystem final : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// Queue the interpolation of a simulated proxy, the result is applied once all proxies ticked this frame
+	void AddProxy(USceneComponent* MeshOffsetRoot, UGoKartMovementComponent* MovementComponent,
+	              const FGoKartProxyInterpolation& Proxy, float VelocityToDerivative);
+
+	// Evaluate the queued proxies and apply the results to their components
+	void Flush();
+
+	// Called every frame after all the actors ticked
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	UPROPERTY()
+	TArray<TObjectPtr<USceneComponent>> MeshOffsetRoots;
+
+	UPROPERTY()
+	TArray<TObjectPtr<UGoKartMovementComponent>> MovementComponents;
+
+	TArray<double> VelocityToDerivatives;
+	FGoKartProxyInterpolationBatch Batch;
+};
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "GoKartRaceHostSubsystem.generated.h"
+
+/**
+ * Dedicated server only. Hosts extra independent races in this process, the same way PIE runs several
+ * servers and clients in one editor: each race gets its own game instance, world context, world, net driver
+ * listening on its own port and karts, while the loaded packages (meshes, blueprints, input...) are shared.
+ * Each extra race loads the map into a package named <Map>_RaceSession<N>, UGoKartGameEngine remaps the
+ * paths sent to and received from its clients to the original map.
+ *
+ * -RaceSessions=<N>              Races hosted by the process, the first one is the regular game instance (default 1)
+ * -RaceSessionBasePort=<Port>    Port of the second race, the next races use the following ports (default server port + 1)
+ * -RaceSessionMap=<Map>          Map of the extra races (default the map of the first race)
+ *
+ * Use KrazyKarts.ListRaceSessions to log the memory and tick time per race.
+ *
+ * Limit, still open: the engine ticks the worlds one after the other on the game thread, so the races do not
+ * spread across cores and the game thread time of all the races adds up. Ticking each world on its own thread
+ * is not supported by the engine (actors, net drivers and UObjects assume the game thread), the alternative
+ * is one process per core hosting a share of the races.
+ */
+UCLASS()
+class KRAZYKARTS_API UGoKartRaceHostSubsystem final : public UGameInstanceSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	// Log the races hosted by this process with their memory and tick time
+	void LogRaceSessions() const;
+
+	// The subsystem of the process, only the first game instance hosts races
+	static UGoKartRaceHostSubsystem* Get() { return Host.Get(); }
+
+	// Swap the package of the map of an extra race between its instance name on the server and its original name
+	// on the network, returns true if Path was modified
+	bool RemapRaceSessionPath(const UWorld* World, FString& Path, bool bReading) const;
+
+private:
+	struct FRaceSession
+	{
+		TWeakObjectPtr<UGameInstance> GameInstance;
+		int32 Port{0};
+		FString MapPackageName;
+		FString InstancePackageName; // Empty for the first race, its map is loaded under its own name
+		uint64 MemoryBytes{0}; // Process memory grown while the race was created
+		double TickStartSeconds{0.0};
+		double AverageTickMilliseconds{0.0};
+	};
+
+	void OnPostLoadMap(UWorld* LoadedWorld);
+	bool StartRaceSession(const FString& MapName, int32 Port);
+	UWorld* LoadMapInstance(const FString& MapName, const FString& InstancePackageName);
+	FRaceSession* FindRaceSession(const UWorld* World);
+	void OnWorldTickStart(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+	void OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	static TWeakObjectPtr<UGoKartRaceHostSubsystem> Host;
+
+	UPROPERTY()
+	TArray<TObjectPtr<UGameInstance>> HostedGameInstances; // Extra races only, the first race is owned by the engine
+
+	TArray<FRaceSession> RaceSessions; // All the races, including the first one
+	bool bRaceSessionsStarted{false};
+};
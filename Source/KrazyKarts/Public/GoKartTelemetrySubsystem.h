@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartMovementReplicationComponent.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "UObject/ObjectKey.h"
+#include "GoKartTelemetrySubsystem.generated.h"
+
+/**
+ * Quantized kart state as written in the telemetry stream, every value is delta encoded against the previous record
+ */
+struct FGoKartTelemetryState
+{
+	static constexpr int32 NumValues = 11;
+
+	// Location (cm), velocity (cm/s), rotation pitch/yaw/roll (1/100 deg), throttle and steering (1/1000)
+	int32 Values[NumValues]{};
+};
+
+/**
+ * Server only. Writes the state of all the karts at KrazyKarts.Telemetry.Rate to an append only file in
+ * Saved/Telemetry so overlays, casters and offline tools can follow a race without a game client.
+ *
+ * File layout (little endian), decoded by Tools/TelemetryReader:
+ *   Header:  "KKTL" | uint16 version | uint16 reserved | float rate (Hz)
+ *   Record:  uint8 type (0 keyframe, 1 delta) | uint32 payload size | payload
+ *   Payload: double server time | varint num karts | per kart: varint kart id, FGoKartTelemetryState::NumValues zigzag varints
+ *
+ * Keyframes store absolute values and are written every KrazyKarts.Telemetry.KeyframeInterval seconds, a
+ * reader seeks by skipping records using their payload size and starts decoding from any keyframe.
+ */
+UCLASS()
+class KRAZYKARTS_API UGoKartTelemetrySubsystem final : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+	// Writes records of synthetic karts to measure their cost
+	friend class UGoKartBenchmarkCommandlet;
+
+public:
+	static constexpr uint16 Version = 1;
+
+	virtual void Deinitialize() override;
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	bool OpenStream(const FString& FileName, float Rate);
+
+	// Gather the server state of every kart and write them as a record
+	void WriteRecord(bool bKeyframe);
+
+	// Encode the given kart states as a record and append it to the stream
+	void WriteRecord(double ServerTime, bool bKeyframe, TConstArrayView<TPair<uint32, FGoKartState>> States);
+
+	// Log the cost of the records written since the last report, warns when any of them was over budget
+	void ReportRecordCost();
+
+	TUniquePtr<IFileHandle> Stream;
+	TMap<FObjectKey, uint32> KartIds;
+	TMap<uint32, FGoKartTelemetryState> PreviousStates; // Last written state of each kart, base of the delta encoding
+	TArray<TPair<uint32, FGoKartState>> KartStates; // Kept between records to avoid reallocating
+	TArray<uint8> RecordBuffer; // Kept between records to avoid reallocating
+	uint32 NextKartId{0};
+	float TimeSinceLastRecord{0.0f};
+	float TimeSinceLastKeyframe{0.0f};
+	int32 NumRecords{0};
+	int32 NumReportedRecords{0}; // Records since the last report
+	int32 NumReportedRecordsOverBudget{0};
+	double ReportedRecordSeconds{0.0};
+	double MaxReportedRecordSeconds{0.0};
+	bool bStreamFailed{false};
+};
@@ -0,0 +1,21 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+using UnrealBuildTool;
+using System.Collections.Generic;
+
+public class KrazyKartsServerTarget : TargetRules
+{
+	public KrazyKartsServerTarget(TargetInfo Target) : base(Target)
+	{
+		Type = TargetType.Server;
+		DefaultBuildSettings = BuildSettingsVersion.V2;
+
+		// Required to change engine build settings, the shared build environment is the one of UnrealServer
+		BuildEnvironment = TargetBuildEnvironment.Unique;
+
+		// Keep the logs of shipping servers, they are the only way to diagnose a race on the fleet
+		bUseLoggingInShipping = true;
+
+		ExtraModuleNames.AddRange( new string[] { "KrazyKarts" } );
+	}
+}
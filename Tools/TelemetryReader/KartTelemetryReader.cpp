@@ -0,0 +1,220 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+// Reference reader of the kart telemetry stream written by UGoKartTelemetrySubsystem, see
+// Source/KrazyKarts/Public/GoKartTelemetrySubsystem.h for the file layout.
+//
+// Standalone, no engine dependency:
+//   c++ -std=c++17 -O2 KartTelemetryReader.cpp -o KartTelemetryReader
+//
+// Usage:
+//   KartTelemetryReader <file.kktl>                  Print every record
+//   KartTelemetryReader <file.kktl> --from <seconds>  Seek to the last keyframe before <seconds> and print from there
+//   KartTelemetryReader <file.kktl> --index          Only list the keyframes (seek points)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace
+{
+	constexpr uint16_t SupportedVersion = 1;
+	constexpr int NumValues = 11;
+	constexpr size_t RecordHeaderSize = 5;
+
+	struct FKartState
+	{
+		int32_t Values[NumValues]{};
+	};
+
+	struct FRecordInfo
+	{
+		long Offset{0}; // Offset of the record header in the file
+		uint8_t Type{0};
+		uint32_t PayloadSize{0};
+		double Time{0};
+	};
+
+	bool ReadVarUInt(const uint8_t*& Cursor, const uint8_t* End, uint32_t& OutValue)
+	{
+		OutValue = 0;
+		for (int Shift = 0; Shift < 35 && Cursor < End; Shift += 7)
+		{
+			const uint8_t Byte = *Cursor++;
+			OutValue |= static_cast<uint32_t>(Byte & 0x7F) << Shift;
+			if ((Byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ReadVarInt(const uint8_t*& Cursor, const uint8_t* End, int32_t& OutValue)
+	{
+		uint32_t ZigZag;
+		if (!ReadVarUInt(Cursor, End, ZigZag))
+		{
+			return false;
+		}
+		OutValue = static_cast<int32_t>((ZigZag >> 1) ^ (~(ZigZag & 1) + 1));
+		return true;
+	}
+
+	// Read the next record header and leave the file at the start of its payload, false at the end of the stream
+	bool ReadRecordInfo(FILE* File, FRecordInfo& OutInfo)
+	{
+		uint8_t Header[RecordHeaderSize + sizeof(double)];
+		OutInfo.Offset = std::ftell(File);
+		if (std::fread(Header, 1, sizeof(Header), File) != sizeof(Header))
+		{
+			return false;
+		}
+
+		OutInfo.Type = Header[0];
+		std::memcpy(&OutInfo.PayloadSize, &Header[1], sizeof(uint32_t));
+		std::memcpy(&OutInfo.Time, &Header[RecordHeaderSize], sizeof(double));
+		std::fseek(File, OutInfo.Offset + static_cast<long>(RecordHeaderSize), SEEK_SET);
+		return OutInfo.PayloadSize >= sizeof(double);
+	}
+
+	// Apply the record to the kart states, records are only printed when bPrint is true
+	bool DecodeRecord(const FRecordInfo& Info, const std::vector<uint8_t>& Payload, std::map<uint32_t, FKartState>& States, bool bPrint)
+	{
+		const uint8_t* Cursor = Payload.data() + sizeof(double);
+		const uint8_t* End = Payload.data() + Payload.size();
+
+		if (Info.Type == 0)
+		{
+			States.clear();
+		}
+
+		uint32_t NumKarts;
+		if (!ReadVarUInt(Cursor, End, NumKarts))
+		{
+			return false;
+		}
+
+		if (bPrint) std::printf("%s t=%.3f karts=%u\n", Info.Type == 0 ? "KEY  " : "DELTA", Info.Time, NumKarts);
+		for (uint32_t Kart = 0; Kart < NumKarts; ++Kart)
+		{
+			uint32_t KartId;
+			if (!ReadVarUInt(Cursor, End, KartId))
+			{
+				return false;
+			}
+
+			FKartState& State = States[KartId];
+			for (int Index = 0; Index < NumValues; ++Index)
+			{
+				int32_t Delta;
+				if (!ReadVarInt(Cursor, End, Delta))
+				{
+					return false;
+				}
+				State.Values[Index] += Delta;
+			}
+
+			const int32_t* V = State.Values;
+			if (bPrint) std::printf("  kart %u loc=(%d, %d, %d)cm vel=(%d, %d, %d)cm/s rot=(%.2f, %.2f, %.2f)deg throttle=%.3f steering=%.3f\n",
+			            KartId, V[0], V[1], V[2], V[3], V[4], V[5], V[6] / 100.0, V[7] / 100.0, V[8] / 100.0,
+			            V[9] / 1000.0, V[10] / 1000.0);
+		}
+		return true;
+	}
+}
+
+int main(int Argc, char** Argv)
+{
+	if (Argc < 2)
+	{
+		std::fprintf(stderr, "Usage: %s <file.kktl> [--from <seconds> | --index]\n", Argv[0]);
+		return 1;
+	}
+
+	const bool bIndexOnly = Argc > 2 && std::strcmp(Argv[2], "--index") == 0;
+	const bool bSeek = Argc > 3 && std::strcmp(Argv[2], "--from") == 0;
+	const double FromTime = bSeek ? std::atof(Argv[3]) : 0.0;
+
+	FILE* File = std::fopen(Argv[1], "rb");
+	if (File == nullptr)
+	{
+		std::fprintf(stderr, "Unable to open %s\n", Argv[1]);
+		return 1;
+	}
+
+	char Magic[4];
+	uint16_t Version, Reserved;
+	float Rate;
+	if (std::fread(Magic, 1, 4, File) != 4 || std::memcmp(Magic, "KKTL", 4) != 0
+		|| std::fread(&Version, sizeof(Version), 1, File) != 1 || std::fread(&Reserved, sizeof(Reserved), 1, File) != 1
+		|| std::fread(&Rate, sizeof(Rate), 1, File) != 1)
+	{
+		std::fprintf(stderr, "%s is not a kart telemetry stream\n", Argv[1]);
+		std::fclose(File);
+		return 1;
+	}
+
+	if (Version != SupportedVersion)
+	{
+		std::fprintf(stderr, "Unsupported telemetry version %u, expected %u\n", Version, SupportedVersion);
+		std::fclose(File);
+		return 1;
+	}
+
+	std::printf("Kart telemetry v%u at %.1f Hz\n", Version, Rate);
+
+	// Seeking only reads the record headers, the payloads are skipped
+	if (bIndexOnly || bSeek)
+	{
+		long StartOffset = std::ftell(File);
+		FRecordInfo Info;
+		while (ReadRecordInfo(File, Info))
+		{
+			if (Info.Type == 0)
+			{
+				if (bIndexOnly)
+				{
+					std::printf("keyframe t=%.3f offset=%ld\n", Info.Time, Info.Offset);
+				}
+				else if (Info.Time <= FromTime)
+				{
+					StartOffset = Info.Offset;
+				}
+			}
+			std::fseek(File, Info.Offset + static_cast<long>(RecordHeaderSize + Info.PayloadSize), SEEK_SET);
+		}
+
+		if (bIndexOnly)
+		{
+			std::fclose(File);
+			return 0;
+		}
+		std::fseek(File, StartOffset, SEEK_SET);
+	}
+
+	std::map<uint32_t, FKartState> States;
+	std::vector<uint8_t> Payload;
+	FRecordInfo Info;
+	while (ReadRecordInfo(File, Info))
+	{
+		Payload.resize(Info.PayloadSize);
+		if (std::fread(Payload.data(), 1, Payload.size(), File) != Payload.size())
+		{
+			break; // Record still being written
+		}
+
+		// Records between the keyframe and the requested time are still decoded to rebuild the delta base
+		if (!DecodeRecord(Info, Payload, States, Info.Time >= FromTime))
+		{
+			std::fprintf(stderr, "Corrupted record at offset %ld\n", Info.Offset);
+			std::fclose(File);
+			return 1;
+		}
+	}
+
+	std::fclose(File);
+	return 0;
+}